@@ -0,0 +1,142 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+/*
+ * harcurl-bench-simd:
+ *
+ * Compares the UTF-8 and base64 kernels in simd.c with the
+ * glib functions they replace, on bodies of a few sizes.
+ * Every result is printed as one JSON object per line.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "simd.h"
+
+typedef enum _HarBenchKernel {
+  HAR_BENCH_UTF8_VALIDATE,
+  HAR_BENCH_BASE64_ENCODE,
+  HAR_BENCH_BASE64_DECODE,
+} HarBenchKernel;
+
+static const char * har_bench_kernel_names[] = {
+  "utf8_validate", "base64_encode", "base64_decode"
+};
+
+/* volatile, so that the compiler cannot drop the calls */
+static volatile gsize har_bench_sink = 0;
+
+static void
+har_bench_run_once(HarBenchKernel kernel, gboolean use_glib,
+                   const guchar * data, gsize len, const gchar * text)
+{
+  gsize out_len = 0;
+  gpointer out;
+
+  switch (kernel) {
+  case HAR_BENCH_UTF8_VALIDATE:
+    har_bench_sink += use_glib ?
+      g_utf8_validate((const gchar *)data, len, NULL) :
+      har_utf8_validate((const gchar *)data, len);
+    break;
+  case HAR_BENCH_BASE64_ENCODE:
+    out = use_glib ? g_base64_encode(data, len) : har_base64_encode(data, len);
+    har_bench_sink += ((gchar *)out)[0];
+    g_free(out);
+    break;
+  case HAR_BENCH_BASE64_DECODE:
+    out = use_glib ? g_base64_decode(text, &out_len) : har_base64_decode(text, &out_len);
+    har_bench_sink += out_len;
+    g_free(out);
+    break;
+  }
+}
+
+static void
+har_bench_run(HarBenchKernel kernel, const char * input, HarSimdLevel level,
+              gboolean use_glib, const guchar * data, gsize len)
+{
+  gchar * text = g_base64_encode(data, len);
+  gsize bytes = 0;
+  guint iterations = 0;
+  gint64 started;
+  gint64 elapsed;
+
+  har_simd_set_level(level);
+
+  /* warm up, then run for at least a quarter of a second */
+  har_bench_run_once(kernel, use_glib, data, len, text);
+  started = g_get_monotonic_time();
+  do {
+    har_bench_run_once(kernel, use_glib, data, len, text);
+    bytes += len;
+    iterations++;
+    elapsed = g_get_monotonic_time() - started;
+  } while (elapsed < 250000);
+
+  printf("{\"kernel\": \"%s\", \"input\": \"%s\", \"size\": %lu, \"impl\": \"%s\", "
+         "\"iterations\": %u, \"nsPerIteration\": %.1f, \"mbPerSecond\": %.1f}\n",
+         har_bench_kernel_names[kernel], input, (unsigned long)len,
+         use_glib ? "glib" : har_simd_level_name(level), iterations,
+         (1.0e3)*(double)elapsed/(double)iterations,
+         (double)bytes/(double)elapsed);
+  g_free(text);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static const gsize sizes[] = { 1024, 64 * 1024, 4 * 1024 * 1024 };
+  HarSimdLevel best = har_simd_level();
+  int ix;
+  int level;
+  gsize jx;
+
+  for (ix = 0; ix < G_N_ELEMENTS(sizes); ix++) {
+    gsize len = sizes[ix];
+    guchar * ascii = g_malloc(len);
+    guchar * mixed = g_malloc(len);
+    guchar * binary = g_malloc(len);
+
+    /* text with a multi-byte character every 16 bytes, and random bytes */
+    for (jx = 0; jx < len; jx++) {
+      ascii[jx] = 'a' + (jx % 26);
+      binary[jx] = (guchar)g_random_int_range(0, 256);
+    }
+    for (jx = 0; jx + 3 <= len; jx += 3) {
+      if (jx % 16 < 3) {
+        memcpy(mixed + jx, "\xe2\x82\xac", 3);
+      } else {
+        memcpy(mixed + jx, "abc", 3);
+      }
+    }
+    memset(mixed + jx, 'z', len - jx);
+
+    har_bench_run(HAR_BENCH_UTF8_VALIDATE, "ascii", HAR_SIMD_NONE, TRUE, ascii, len);
+    har_bench_run(HAR_BENCH_UTF8_VALIDATE, "mixed", HAR_SIMD_NONE, TRUE, mixed, len);
+    har_bench_run(HAR_BENCH_BASE64_ENCODE, "binary", HAR_SIMD_NONE, TRUE, binary, len);
+    har_bench_run(HAR_BENCH_BASE64_DECODE, "binary", HAR_SIMD_NONE, TRUE, binary, len);
+    for (level = HAR_SIMD_SSE4; level <= best; level++) {
+      har_bench_run(HAR_BENCH_UTF8_VALIDATE, "ascii", level, FALSE, ascii, len);
+      har_bench_run(HAR_BENCH_UTF8_VALIDATE, "mixed", level, FALSE, mixed, len);
+      har_bench_run(HAR_BENCH_BASE64_ENCODE, "binary", level, FALSE, binary, len);
+      har_bench_run(HAR_BENCH_BASE64_DECODE, "binary", level, FALSE, binary, len);
+    }
+
+    g_free(ascii);
+    g_free(mixed);
+    g_free(binary);
+  }
+
+  return 0;
+}
@@ -0,0 +1,600 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+/*
+ * harcurl-bench:
+ *
+ * Two kinds of benchmarks, both printed as one JSON object
+ * per line, so that results can be kept and compared
+ * between releases:
+ *
+ * "micro" runs the conversion functions in a loop.
+ * "e2e" runs the harcurl program on generated HAR logs,
+ * against a loopback HTTP server embedded in this program,
+ * which serves bodies of a given size, gzipped or not,
+ * after a given delay, for example /bench?size=1024&gzip=1&delay=20
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <curl/curl.h>
+#include <glib.h>
+#include <jansson.h>
+#include <zlib.h>
+
+#include "config.h"
+#include "harcurl.h"
+
+/* volatile, so that the compiler cannot drop the calls */
+static volatile gsize har_bench_sink = 0;
+
+static void
+har_bench_print(json_t * result)
+{
+  json_object_set_new(result, "version", json_string(PACKAGE_VERSION));
+  json_dumpf(result, stdout, JSON_SORT_KEYS | JSON_COMPACT);
+  fputs("\n", stdout);
+  fflush(stdout);
+  json_decref(result);
+}
+
+/*
+ * HarBenchServer:
+ *
+ * A small HTTP/1.1 server with keep-alive, one thread per
+ * connection. It is just good enough for harcurl.
+ */
+typedef struct _HarBenchServer {
+  int fd;
+  int port;
+  GThread * thread;
+  GMutex lock;
+  GHashTable * bodies;
+} HarBenchServer;
+
+typedef struct _HarBenchConnection {
+  HarBenchServer * server;
+  int fd;
+} HarBenchConnection;
+
+static GBytes *
+har_bench_server_body(HarBenchServer * server, gsize size, gboolean gzip)
+{
+  gchar * key = g_strdup_printf("%lu/%d", (unsigned long)size, gzip);
+  GBytes * body;
+
+  g_mutex_lock(&server->lock);
+  body = g_hash_table_lookup(server->bodies, key);
+  if (!body) {
+    guchar * text = g_malloc(size);
+    gsize ix;
+
+    /* some text that compresses about as well as HTML */
+    for (ix = 0; ix < size; ix++) {
+      text[ix] = (ix % 61 == 60) ? '\n' : "abcdefghij klmnopqrst uvwxyz <tag attr=\"value\">"[(ix * 7 + ix / 61) % 48];
+    }
+
+    if (gzip) {
+      z_stream stream;
+      GByteArray * out = g_byte_array_sized_new(size / 2 + 64);
+      memset(&stream, 0, sizeof(stream));
+      deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS | 16, 8, Z_DEFAULT_STRATEGY);
+      g_byte_array_set_size(out, deflateBound(&stream, size));
+      stream.next_in = text;
+      stream.avail_in = size;
+      stream.next_out = out->data;
+      stream.avail_out = out->len;
+      deflate(&stream, Z_FINISH);
+      g_byte_array_set_size(out, stream.total_out);
+      deflateEnd(&stream);
+      body = g_byte_array_free_to_bytes(out);
+      g_free(text);
+    } else {
+      body = g_bytes_new_take(text, size);
+    }
+    g_hash_table_insert(server->bodies, g_strdup(key), body);
+  }
+  g_mutex_unlock(&server->lock);
+
+  g_free(key);
+  return body;
+}
+
+static gboolean
+har_bench_write_all(int fd, const void * data, gsize len)
+{
+  const char * p = data;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FALSE;
+    p += n;
+    len -= n;
+  }
+  return TRUE;
+}
+
+static gpointer
+har_bench_connection_thread(gpointer data)
+{
+  HarBenchConnection * conn = (HarBenchConnection *)data;
+  GString * buf = g_string_new(NULL);
+  char chunk[4096];
+
+  for (;;) {
+    gchar * end;
+    gchar * query;
+    gsize size = 1024;
+    gboolean gzip = FALSE;
+    gulong delay = 0;
+    gsize body_len;
+    gconstpointer body_data;
+    GBytes * body;
+    gchar * head;
+    ssize_t n;
+    int ix;
+
+    /* read one request head, we never get request bodies */
+    while (!(end = strstr(buf->str, "\r\n\r\n"))) {
+      n = recv(conn->fd, chunk, sizeof(chunk), 0);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) goto done;
+      g_string_append_len(buf, chunk, n);
+    }
+    *end = '\0';
+
+    query = strchr(buf->str, '?');
+    if (query && query < strstr(buf->str, "\r\n")) {
+      gchar * text = g_strndup(query + 1, strcspn(query + 1, " \r\n"));
+      gchar ** params = g_strsplit(text, "&", -1);
+      g_free(text);
+      for (ix = 0; params[ix]; ix++) {
+        if (g_str_has_prefix(params[ix], "size=")) {
+          size = g_ascii_strtoull(params[ix] + 5, NULL, 10);
+        } else if (g_str_has_prefix(params[ix], "gzip=")) {
+          gzip = params[ix][5] == '1';
+        } else if (g_str_has_prefix(params[ix], "delay=")) {
+          delay = g_ascii_strtoull(params[ix] + 6, NULL, 10);
+        }
+      }
+      g_strfreev(params);
+    }
+    g_string_erase(buf, 0, (end + 4) - buf->str);
+
+    if (delay > 0) {
+      g_usleep(delay * 1000);
+    }
+
+    body = har_bench_server_body(conn->server, size, gzip);
+    body_data = g_bytes_get_data(body, &body_len);
+    head = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+                           "Content-Type: text/plain\r\n"
+                           "%s"
+                           "Content-Length: %lu\r\n"
+                           "\r\n",
+                           gzip ? "Content-Encoding: gzip\r\n" : "",
+                           (unsigned long)body_len);
+    if (!har_bench_write_all(conn->fd, head, strlen(head)) ||
+        !har_bench_write_all(conn->fd, body_data, body_len)) {
+      g_free(head);
+      goto done;
+    }
+    g_free(head);
+  }
+
+ done:
+  close(conn->fd);
+  g_string_free(buf, TRUE);
+  g_free(conn);
+  return NULL;
+}
+
+static gpointer
+har_bench_server_thread(gpointer data)
+{
+  HarBenchServer * server = (HarBenchServer *)data;
+  int one = 1;
+
+  for (;;) {
+    int fd = accept(server->fd, NULL, NULL);
+    HarBenchConnection * conn;
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    /* the head and the body are written separately */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    conn = g_new0(HarBenchConnection, 1);
+    conn->server = server;
+    conn->fd = fd;
+    g_thread_unref(g_thread_new("bench-conn", &har_bench_connection_thread, conn));
+  }
+
+  return NULL;
+}
+
+static int
+har_bench_server_start(HarBenchServer * server)
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  int one = 1;
+
+  memset(server, 0, sizeof(*server));
+  g_mutex_init(&server->lock);
+  server->bodies = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_bytes_unref);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+
+  server->fd = socket(AF_INET, SOCK_STREAM, 0);
+  setsockopt(server->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (server->fd < 0 ||
+      bind(server->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(server->fd, 128) < 0 ||
+      getsockname(server->fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+    fprintf(stderr, "unable to start the loopback server: %s\n", strerror(errno));
+    return HAR_ERROR_UNKNOWN;
+  }
+  server->port = ntohs(addr.sin_port);
+  server->thread = g_thread_new("bench-server", &har_bench_server_thread, server);
+  return HAR_OK;
+}
+
+/*
+ * Microbenchmarks
+ */
+
+typedef void (*HarBenchFunc)(gpointer data);
+
+static void
+har_bench_micro(const char * name, HarBenchFunc func, gpointer data, gsize bytes)
+{
+  guint iterations = 0;
+  gint64 started;
+  gint64 elapsed;
+  json_t * result = json_object();
+
+  /* warm up, then run for at least a quarter of a second */
+  func(data);
+  started = g_get_monotonic_time();
+  do {
+    func(data);
+    iterations++;
+    elapsed = g_get_monotonic_time() - started;
+  } while (elapsed < 250000);
+
+  json_object_set_new(result, "bench", json_string("micro"));
+  json_object_set_new(result, "name", json_string(name));
+  json_object_set_new(result, "iterations", json_integer(iterations));
+  json_object_set_new(result, "nsPerIteration", json_real((1.0e3)*(double)elapsed/(double)iterations));
+  if (bytes) {
+    json_object_set_new(result, "size", json_integer(bytes));
+    json_object_set_new(result, "mbPerSecond", json_real((double)bytes*(double)iterations/(double)elapsed));
+  }
+  har_bench_print(result);
+}
+
+typedef struct _HarBenchSetopt {
+  json_t * entry;
+  CURL * easy;
+} HarBenchSetopt;
+
+static void
+har_bench_setopt(gpointer data)
+{
+  HarBenchSetopt * bench = (HarBenchSetopt *)data;
+  json_t * entry = json_deep_copy(bench->entry);
+  GByteArray * harbodyin = g_byte_array_new();
+  GByteArray * harheadout = g_byte_array_new();
+  GByteArray * harbodyout = g_byte_array_new();
+
+  curl_easy_reset(bench->easy);
+  har_entry_prepare(entry);
+  har_bench_sink += har_entry_to_curl_easy_setopt(entry, bench->easy, harbodyin, harheadout, harbodyout);
+
+  g_byte_array_free(harbodyin, TRUE);
+  g_byte_array_free(harheadout, TRUE);
+  g_byte_array_free(harbodyout, TRUE);
+  json_decref(entry);
+}
+
+static void
+har_bench_headers_from_text(gpointer data)
+{
+  json_t * headers = json_array();
+  har_headers_from_text(headers, (const char *)data, strlen((const char *)data));
+  har_bench_sink += json_array_size(headers);
+  json_decref(headers);
+}
+
+static void
+har_bench_content_from_byte_array(gpointer data)
+{
+  json_t * resp = json_object();
+  json_object_set_new(resp, "content", json_object());
+  har_response_content_from_byte_array(resp, (GByteArray *)data);
+  har_bench_sink += json_object_size(json_object_get(resp, "content"));
+  json_decref(resp);
+}
+
+static void
+har_bench_bytes_uncompress(gpointer data)
+{
+  GBytes * out = har_bytes_uncompress((GBytes *)data, har_window_bits("gzip"));
+  har_bench_sink += g_bytes_get_size(out);
+  if (out != data) {
+    g_bytes_unref(out);
+  }
+}
+
+static void
+har_bench_micro_all(HarBenchServer * server)
+{
+  int ix;
+  HarBenchSetopt setopt;
+  json_error_t error;
+  GBytes * text = har_bench_server_body(server, 64 * 1024, FALSE);
+  GBytes * gzip = har_bench_server_body(server, 64 * 1024, TRUE);
+  GByteArray * text_array = g_byte_array_new();
+  GByteArray * binary_array = g_byte_array_new();
+  GString * head = g_string_new("HTTP/1.1 200 OK\r\n");
+  gsize len;
+  gconstpointer data;
+
+  setopt.easy = curl_easy_init();
+  setopt.entry = json_loads("{\"request\": {\"method\": \"POST\","
+                            " \"url\": \"http://127.0.0.1/bench/a/path?x=1\","
+                            " \"httpVersion\": \"HTTP/1.1\","
+                            " \"queryString\": [{\"name\": \"q\", \"value\": \"a b\"}, {\"name\": \"page\", \"value\": \"2\"}],"
+                            " \"headers\": ["
+                            "  {\"name\": \"Accept\", \"value\": \"text/html,application/xhtml+xml\"},"
+                            "  {\"name\": \"Accept-Encoding\", \"value\": \"gzip, deflate\"},"
+                            "  {\"name\": \"Accept-Language\", \"value\": \"en-US,en;q=0.5\"},"
+                            "  {\"name\": \"Cache-Control\", \"value\": \"no-cache\"},"
+                            "  {\"name\": \"Content-Type\", \"value\": \"application/json\"},"
+                            "  {\"name\": \"Cookie\", \"value\": \"session=0123456789abcdef; theme=dark\"},"
+                            "  {\"name\": \"Origin\", \"value\": \"http://127.0.0.1\"},"
+                            "  {\"name\": \"Referer\", \"value\": \"http://127.0.0.1/bench/\"},"
+                            "  {\"name\": \"User-Agent\", \"value\": \"harcurl-bench\"},"
+                            "  {\"name\": \"X-Request-Id\", \"value\": \"5f0c6e1a-6b7e-4c1b-9a52-3f3b0d2b9e11\"}],"
+                            " \"postData\": {\"mimeType\": \"application/json\", \"text\": \"{\\\"hello\\\": \\\"world\\\"}\"}}}",
+                            0, &error);
+  har_bench_micro("har_entry_to_curl_easy_setopt", &har_bench_setopt, &setopt, 0);
+  json_decref(setopt.entry);
+  curl_easy_cleanup(setopt.easy);
+
+  for (ix = 0; ix < 20; ix++) {
+    g_string_append_printf(head, "X-Header-%02d: some value that is about as long as a real one %d\r\n", ix, ix);
+  }
+  g_string_append(head, "\r\n");
+  har_bench_micro("har_headers_from_text", &har_bench_headers_from_text, head->str, head->len);
+
+  data = g_bytes_get_data(text, &len);
+  g_byte_array_append(text_array, data, len);
+  har_bench_micro("har_response_content_from_byte_array/text", &har_bench_content_from_byte_array, text_array, len);
+
+  for (ix = 0; ix < len; ix++) {
+    guint8 byte = (guint8)g_random_int_range(0, 256);
+    g_byte_array_append(binary_array, &byte, 1);
+  }
+  har_bench_micro("har_response_content_from_byte_array/binary", &har_bench_content_from_byte_array, binary_array, len);
+
+  har_bench_micro("har_bytes_uncompress/gzip", &har_bench_bytes_uncompress, gzip, g_bytes_get_size(text));
+
+  g_byte_array_free(text_array, TRUE);
+  g_byte_array_free(binary_array, TRUE);
+  g_string_free(head, TRUE);
+}
+
+/*
+ * End-to-end benchmarks
+ */
+
+static gint
+har_bench_compare_double(gconstpointer a, gconstpointer b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double
+har_bench_percentile(GArray * values, double p)
+{
+  if (values->len == 0) return -1;
+  return g_array_index(values, double, (guint)(p * (values->len - 1) + 0.5));
+}
+
+static void
+har_bench_e2e(HarBenchServer * server, const char * harcurl,
+              int requests, gsize size, gboolean gzip, int delay, int parallel)
+{
+  int ix;
+  int errors = 0;
+  int fd;
+  double sum = 0;
+  gint64 started;
+  gint64 elapsed;
+  gchar * path = NULL;
+  gchar * command;
+  FILE * pipe;
+  json_t * log = json_object();
+  json_t * entries = json_array();
+  json_t * output;
+  json_t * entry;
+  json_t * result;
+  json_error_t error;
+  GArray * times = g_array_new(FALSE, FALSE, sizeof(double));
+
+  for (ix = 0; ix < requests; ix++) {
+    gchar * url = g_strdup_printf("http://127.0.0.1:%d/bench?size=%lu&gzip=%d&delay=%d&n=%d",
+                                  server->port, (unsigned long)size, gzip, delay, ix);
+    json_array_append_new(entries, json_pack("{s:{s:s,s:s}}", "request", "method", "GET", "url", url));
+    g_free(url);
+  }
+  json_object_set_new(log, "log", json_pack("{s:s,s:o}", "version", "1.2", "entries", entries));
+
+  fd = g_file_open_tmp("harcurl-bench-XXXXXX.json", &path, NULL);
+  if (fd < 0) {
+    fprintf(stderr, "unable to create a temporary file\n");
+    return;
+  }
+  close(fd);
+  json_dump_file(log, path, JSON_COMPACT);
+  json_decref(log);
+
+  /* -v, so that the whole conversion is done, including decompression */
+  command = g_strdup_printf("'%s' -v -p %d < '%s' 2>/dev/null", harcurl, parallel, path);
+  started = g_get_monotonic_time();
+  pipe = popen(command, "r");
+  output = pipe ? json_loadf(pipe, 0, &error) : NULL;
+  if (pipe) pclose(pipe);
+  elapsed = g_get_monotonic_time() - started;
+  unlink(path);
+
+  entries = json_object_get(json_object_get(output, "log"), "entries");
+  json_array_foreach(entries, ix, entry) {
+    json_t * time = json_object_get(entry, "time");
+    long status = (long)json_integer_value(json_object_get(json_object_get(entry, "response"), "status"));
+    if (status != 200 || !json_is_number(time)) {
+      errors++;
+      continue;
+    }
+    double t = json_number_value(time);
+    g_array_append_val(times, t);
+    sum += t;
+  }
+  errors += requests - (int)json_array_size(entries);
+  g_array_sort(times, &har_bench_compare_double);
+
+  result = json_object();
+  json_object_set_new(result, "bench", json_string("e2e"));
+  json_object_set_new(result, "size", json_integer(size));
+  json_object_set_new(result, "gzip", json_boolean(gzip));
+  json_object_set_new(result, "delay", json_integer(delay));
+  json_object_set_new(result, "parallel", json_integer(parallel));
+  json_object_set_new(result, "requests", json_integer(requests));
+  json_object_set_new(result, "errors", json_integer(errors));
+  json_object_set_new(result, "wall", json_real((1.0e-3)*(double)elapsed));
+  json_object_set_new(result, "requestsPerSecond", json_real((1.0e6)*(double)times->len/(double)elapsed));
+  json_object_set_new(result, "mbPerSecond", json_real((double)(size * times->len)/(double)elapsed));
+  json_object_set_new(result, "mean", json_real(times->len ? sum / times->len : -1));
+  json_object_set_new(result, "p50", json_real(har_bench_percentile(times, 0.50)));
+  json_object_set_new(result, "p90", json_real(har_bench_percentile(times, 0.90)));
+  json_object_set_new(result, "p99", json_real(har_bench_percentile(times, 0.99)));
+  if (json_is_object(json_object_get(json_object_get(output, "log"), "_pipeline"))) {
+    json_object_set(result, "pipeline", json_object_get(json_object_get(output, "log"), "_pipeline"));
+  }
+  har_bench_print(result);
+
+  json_decref(output);
+  g_array_free(times, TRUE);
+  g_free(command);
+  g_free(path);
+}
+
+static GArray *
+har_bench_parse_list(const char * text)
+{
+  int ix;
+  GArray * values = g_array_new(FALSE, FALSE, sizeof(gint64));
+  gchar ** parts = g_strsplit(text, ",", -1);
+
+  for (ix = 0; parts[ix]; ix++) {
+    gint64 value = g_ascii_strtoll(parts[ix], NULL, 10);
+    g_array_append_val(values, value);
+  }
+
+  g_strfreev(parts);
+  return values;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ix;
+  int jx;
+  int kx;
+  int gzip;
+  int requests = 100;
+  gchar * harcurl = "./harcurl";
+  gchar * only = NULL;
+  gchar * sizes_text = "1024,65536,1048576";
+  gchar * delays_text = "0,20";
+  gchar * parallel_text = "1,8";
+  GArray * sizes;
+  GArray * delays;
+  GArray * parallel;
+  GError * option_error = NULL;
+  GOptionContext * options;
+  HarBenchServer server;
+
+  GOptionEntry option_entries[] = {
+    { "harcurl", 0, 0, G_OPTION_ARG_FILENAME, &harcurl,
+      "The harcurl program to run (default ./harcurl)", "PATH" },
+    { "only", 0, 0, G_OPTION_ARG_STRING, &only,
+      "Only run the micro or the e2e benchmarks", "micro|e2e" },
+    { "requests", 'n', 0, G_OPTION_ARG_INT, &requests,
+      "Number of entries in every e2e run (default 100)", "N" },
+    { "sizes", 0, 0, G_OPTION_ARG_STRING, &sizes_text,
+      "Body sizes of the e2e runs (default 1024,65536,1048576)", "LIST" },
+    { "delays", 0, 0, G_OPTION_ARG_STRING, &delays_text,
+      "Server delays in milliseconds of the e2e runs (default 0,20)", "LIST" },
+    { "parallel", 0, 0, G_OPTION_ARG_STRING, &parallel_text,
+      "Values of harcurl --parallel for the e2e runs (default 1,8)", "LIST" },
+    NULL
+  };
+
+  options = g_option_context_new("harcurl-bench (" PACKAGE_VERSION ")");
+  g_option_context_add_main_entries(options, option_entries, NULL);
+  if (g_option_context_parse(options, &argc, &argv, &option_error) != TRUE) {
+    fprintf(stderr, "error parsing options\n");
+    return HAR_ERROR_UNKNOWN;
+  }
+
+  curl_global_init(CURL_GLOBAL_ALL);
+  if (har_bench_server_start(&server) != HAR_OK) {
+    return HAR_ERROR_UNKNOWN;
+  }
+
+  if (!only || !strcmp(only, "micro")) {
+    har_bench_micro_all(&server);
+  }
+
+  if (!only || !strcmp(only, "e2e")) {
+    sizes = har_bench_parse_list(sizes_text);
+    delays = har_bench_parse_list(delays_text);
+    parallel = har_bench_parse_list(parallel_text);
+    for (ix = 0; ix < sizes->len; ix++) {
+      for (gzip = 0; gzip <= 1; gzip++) {
+        for (jx = 0; jx < delays->len; jx++) {
+          for (kx = 0; kx < parallel->len; kx++) {
+            har_bench_e2e(&server, harcurl, requests,
+                          (gsize)g_array_index(sizes, gint64, ix), gzip,
+                          (int)g_array_index(delays, gint64, jx),
+                          (int)g_array_index(parallel, gint64, kx));
+          }
+        }
+      }
+    }
+  }
+
+  curl_global_cleanup();
+  return 0;
+}
@@ -0,0 +1,819 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+/*
+ * The binary capture format (--capture), and the converter
+ * back to HAR or NDJSON (harcurl convert). See capture.h
+ * for the layout of the file.
+ *
+ * An entry record is:
+ *
+ *   u32:index u16:hop u32:len json
+ *   u16:count (u16:name u32:len value)*   request headers
+ *   u16:count (u16:name u32:len value)*   response headers
+ *   u8:has_body u32:len body
+ *
+ * where "json" is the entry without its headers and without
+ * response.content.text, and "body" is the decoded response
+ * body, as it is, which harcurl convert turns into text (or
+ * base64) the same way harcurl does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include <glib.h>
+#include <jansson.h>
+#include <zlib.h>
+
+#include "config.h"
+#include "harcurl.h"
+#include "capture.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define HAR_CAPTURE_HEADER_SIZE 8
+#define HAR_CAPTURE_BLOCK_HEADER_SIZE 32
+
+/* header names are u16, so a block is cut before it has too many */
+#define HAR_CAPTURE_NAMES_MAX 60000
+
+typedef struct _HarCaptureBlock {
+  HarCaptureCodec codec;
+  guint32 count;
+  guint64 first;
+  guint32 raw_len;
+  guint32 stored_len;
+  guint32 crc;
+} HarCaptureBlock;
+
+static void
+har_put_u16(GByteArray * bytes, guint16 value)
+{
+  guint8 b[2] = { value & 0xff, value >> 8 };
+  g_byte_array_append(bytes, b, 2);
+}
+
+static void
+har_put_u32(GByteArray * bytes, guint32 value)
+{
+  guint8 b[4] = { value & 0xff, (value >> 8) & 0xff, (value >> 16) & 0xff, value >> 24 };
+  g_byte_array_append(bytes, b, 4);
+}
+
+static void
+har_put_u64(GByteArray * bytes, guint64 value)
+{
+  har_put_u32(bytes, (guint32)(value & 0xffffffff));
+  har_put_u32(bytes, (guint32)(value >> 32));
+}
+
+static guint16
+har_get_u16(const guint8 * p)
+{
+  return (guint16)(p[0] | (p[1] << 8));
+}
+
+static guint32
+har_get_u32(const guint8 * p)
+{
+  return (guint32)p[0] | ((guint32)p[1] << 8) | ((guint32)p[2] << 16) | ((guint32)p[3] << 24);
+}
+
+static guint64
+har_get_u64(const guint8 * p)
+{
+  return (guint64)har_get_u32(p) | ((guint64)har_get_u32(p + 4) << 32);
+}
+
+int
+har_capture_codec_from_name(const char * name, HarCaptureCodec * codec)
+{
+  if (!g_ascii_strcasecmp(name, "none")) {
+    *codec = HAR_CAPTURE_NONE;
+  } else if (!g_ascii_strcasecmp(name, "gzip")) {
+    *codec = HAR_CAPTURE_GZIP;
+  } else if (!g_ascii_strcasecmp(name, "zstd")) {
+#ifdef HAVE_ZSTD
+    *codec = HAR_CAPTURE_ZSTD;
+#else
+    fprintf(stderr, "zstd needs harcurl to be built with libzstd\n");
+    return HAR_ERROR_CAPTURE;
+#endif
+  } else {
+    fprintf(stderr, "unknown capture compression %s\n", name);
+    return HAR_ERROR_CAPTURE;
+  }
+  return HAR_OK;
+}
+
+static int
+har_capture_compress(HarCaptureCodec codec, GByteArray * raw, GByteArray * stored)
+{
+  z_stream stream;
+  int ret;
+
+  switch (codec) {
+  case HAR_CAPTURE_GZIP:
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS | 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+      return HAR_ERROR_CAPTURE;
+    }
+    g_byte_array_set_size(stored, deflateBound(&stream, raw->len));
+    stream.next_in = raw->data;
+    stream.avail_in = raw->len;
+    stream.next_out = stored->data;
+    stream.avail_out = stored->len;
+    ret = deflate(&stream, Z_FINISH);
+    g_byte_array_set_size(stored, stream.total_out);
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END ? HAR_OK : HAR_ERROR_CAPTURE;
+#ifdef HAVE_ZSTD
+  case HAR_CAPTURE_ZSTD:
+    {
+      size_t len;
+      g_byte_array_set_size(stored, ZSTD_compressBound(raw->len));
+      len = ZSTD_compress(stored->data, stored->len, raw->data, raw->len, 3);
+      if (ZSTD_isError(len)) {
+        fprintf(stderr, "there was an error with zstd: %s\n", ZSTD_getErrorName(len));
+        return HAR_ERROR_CAPTURE;
+      }
+      g_byte_array_set_size(stored, len);
+      return HAR_OK;
+    }
+#endif
+  default:
+    g_byte_array_set_size(stored, 0);
+    g_byte_array_append(stored, raw->data, raw->len);
+    return HAR_OK;
+  }
+}
+
+static int
+har_capture_uncompress(const HarCaptureBlock * block, const guint8 * stored, GByteArray * raw)
+{
+  g_byte_array_set_size(raw, 0);
+  switch (block->codec) {
+  case HAR_CAPTURE_NONE:
+    g_byte_array_append(raw, stored, block->stored_len);
+    break;
+  case HAR_CAPTURE_GZIP:
+    if (block->stored_len > 0 &&
+        har_uncompress(raw, stored, block->stored_len, MAX_WBITS | 16) != Z_OK) {
+      return HAR_ERROR_CAPTURE;
+    }
+    break;
+#ifdef HAVE_ZSTD
+  case HAR_CAPTURE_ZSTD:
+    {
+      size_t len;
+      g_byte_array_set_size(raw, block->raw_len);
+      len = ZSTD_decompress(raw->data, raw->len, stored, block->stored_len);
+      if (ZSTD_isError(len)) {
+        return HAR_ERROR_CAPTURE;
+      }
+      g_byte_array_set_size(raw, len);
+      break;
+    }
+#endif
+  default:
+    fprintf(stderr, "the capture uses an unknown compression (%d)\n", block->codec);
+    return HAR_ERROR_CAPTURE;
+  }
+  return raw->len == block->raw_len ? HAR_OK : HAR_ERROR_CAPTURE;
+}
+
+/* 1 for a block header, 0 at the end of the file, -1 for a torn or foreign block */
+static int
+har_capture_read_block_header(FILE * stream, HarCaptureBlock * block)
+{
+  guint8 header[HAR_CAPTURE_BLOCK_HEADER_SIZE];
+  size_t len = fread(header, 1, sizeof(header), stream);
+
+  if (len == 0 && feof(stream)) return 0;
+  if (len != sizeof(header) || memcmp(header, "HBLK", 4)) return -1;
+  block->codec = (HarCaptureCodec)header[4];
+  block->count = har_get_u32(header + 8);
+  block->first = har_get_u64(header + 12);
+  block->raw_len = har_get_u32(header + 20);
+  block->stored_len = har_get_u32(header + 24);
+  block->crc = har_get_u32(header + 28);
+  if ((guint64)block->count * 4 > block->raw_len) return -1;
+  return 1;
+}
+
+static int
+har_capture_read_file_header(FILE * stream)
+{
+  guint8 header[HAR_CAPTURE_HEADER_SIZE];
+
+  if (fread(header, 1, sizeof(header), stream) != sizeof(header) || memcmp(header, "HCAP", 4)) {
+    fprintf(stderr, "not a harcurl capture file\n");
+    return HAR_ERROR_CAPTURE;
+  }
+  if (har_get_u32(header + 4) != HAR_CAPTURE_VERSION) {
+    fprintf(stderr, "unsupported capture version %u\n", har_get_u32(header + 4));
+    return HAR_ERROR_CAPTURE;
+  }
+  return HAR_OK;
+}
+
+/*
+ * har_capture_open:
+ *
+ * Opens FILE for appending, after the last whole block, so
+ * that a capture torn by a crash can be appended to again.
+ */
+int
+har_capture_open(HarCapture * capture, const char * path, HarCaptureCodec codec, gsize block_size)
+{
+  HarCaptureBlock block;
+  GByteArray * header;
+  long end;
+  int status;
+
+  memset(capture, 0, sizeof(*capture));
+  capture->stream = fopen(path, "r+b");
+  if (!capture->stream) {
+    capture->stream = fopen(path, "w+b");
+  }
+  if (!capture->stream) {
+    fprintf(stderr, "unable to open %s\n", path);
+    return HAR_ERROR_CAPTURE;
+  }
+
+  fseek(capture->stream, 0, SEEK_END);
+  if (ftell(capture->stream) == 0) {
+    header = g_byte_array_new();
+    g_byte_array_append(header, (const guint8 *)"HCAP", 4);
+    har_put_u32(header, HAR_CAPTURE_VERSION);
+    fwrite(header->data, 1, header->len, capture->stream);
+    g_byte_array_free(header, TRUE);
+    end = HAR_CAPTURE_HEADER_SIZE;
+  } else {
+    rewind(capture->stream);
+    if ((status = har_capture_read_file_header(capture->stream)) != HAR_OK) {
+      fclose(capture->stream);
+      return status;
+    }
+    end = HAR_CAPTURE_HEADER_SIZE;
+    while (har_capture_read_block_header(capture->stream, &block) > 0 &&
+           fseek(capture->stream, block.stored_len, SEEK_CUR) == 0) {
+      /* a torn last block is shorter than its header says */
+      fseek(capture->stream, 0, SEEK_END);
+      if (ftell(capture->stream) < end + HAR_CAPTURE_BLOCK_HEADER_SIZE + (long)block.stored_len) break;
+      end += HAR_CAPTURE_BLOCK_HEADER_SIZE + block.stored_len;
+      fseek(capture->stream, end, SEEK_SET);
+      capture->entries = block.first + block.count;
+      capture->blocks++;
+    }
+    fflush(capture->stream);
+    if (ftruncate(fileno(capture->stream), end) != 0) {
+      fprintf(stderr, "unable to drop the torn block at the end of %s\n", path);
+    }
+  }
+  fseek(capture->stream, end, SEEK_SET);
+
+  capture->codec = codec;
+  capture->block_size = MAX(block_size, 1024);
+  capture->raw = g_byte_array_new();
+  capture->offsets = g_array_new(FALSE, FALSE, sizeof(guint32));
+  capture->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  return HAR_OK;
+}
+
+/* writes the block out whole, and drops what is left of it when that fails */
+static int
+har_capture_write_block(HarCapture * capture, GByteArray * stored, guint32 raw_len)
+{
+  GByteArray * header = g_byte_array_sized_new(HAR_CAPTURE_BLOCK_HEADER_SIZE + stored->len);
+  long start = ftell(capture->stream);
+  int status = HAR_OK;
+
+  g_byte_array_append(header, (const guint8 *)"HBLK", 4);
+  har_put_u32(header, (guint32)capture->codec);
+  har_put_u32(header, capture->offsets->len);
+  har_put_u64(header, capture->entries);
+  har_put_u32(header, raw_len);
+  har_put_u32(header, stored->len);
+  har_put_u32(header, (guint32)crc32(0L, stored->data, stored->len));
+  g_byte_array_append(header, stored->data, stored->len);
+
+  /* a short write (ENOSPC, EIO) is cut off, so that the blocks after it can still be read */
+  if (fwrite(header->data, 1, header->len, capture->stream) != header->len ||
+      fflush(capture->stream) != 0) {
+    fprintf(stderr, "unable to write to the capture file, %u entries were lost\n", capture->offsets->len);
+    clearerr(capture->stream);
+    if (ftruncate(fileno(capture->stream), start) != 0) {
+      fprintf(stderr, "unable to drop the torn block of the capture file\n");
+    }
+    fseek(capture->stream, start, SEEK_SET);
+    status = HAR_ERROR_CAPTURE;
+  } else {
+    capture->entries += capture->offsets->len;
+    capture->blocks++;
+  }
+  g_byte_array_free(header, TRUE);
+  return status;
+}
+
+/* writes the block, if it has anything, and returns the first error of the capture */
+static int
+har_capture_flush(HarCapture * capture)
+{
+  GByteArray * stored;
+  guint ix;
+  int status;
+
+  if (!capture->raw->len) return capture->status;
+  for (ix = 0; ix < capture->offsets->len; ix++) {
+    har_put_u32(capture->raw, g_array_index(capture->offsets, guint32, ix));
+  }
+
+  stored = g_byte_array_new();
+  status = har_capture_compress(capture->codec, capture->raw, stored);
+  if (status != HAR_OK) {
+    fprintf(stderr, "unable to compress the capture file, %u entries were lost\n", capture->offsets->len);
+  } else {
+    status = har_capture_write_block(capture, stored, capture->raw->len);
+  }
+  if (capture->status == HAR_OK) {
+    capture->status = status;
+  }
+
+  g_byte_array_set_size(capture->raw, 0);
+  g_array_set_size(capture->offsets, 0);
+  g_hash_table_remove_all(capture->names);
+  g_byte_array_free(stored, TRUE);
+  return capture->status;
+}
+
+static guint16
+har_capture_name(HarCapture * capture, const char * name)
+{
+  gpointer value;
+  guint16 id;
+  gsize len = strlen(name);
+
+  if (g_hash_table_lookup_extended(capture->names, name, NULL, &value)) {
+    return (guint16)GPOINTER_TO_UINT(value);
+  }
+  id = (guint16)g_hash_table_size(capture->names);
+  g_hash_table_insert(capture->names, g_strdup(name), GUINT_TO_POINTER(id));
+  har_put_u32(capture->raw, (guint32)(1 + 2 + len));
+  g_byte_array_append(capture->raw, (const guint8 *)"n", 1);
+  har_put_u16(capture->raw, id);
+  g_byte_array_append(capture->raw, (const guint8 *)name, len);
+  return id;
+}
+
+static void
+har_capture_put_headers(HarCapture * capture, json_t * headers, guint16 * ids)
+{
+  int ix;
+  json_t * header;
+  const char * value;
+
+  har_put_u16(capture->raw, (guint16)json_array_size(headers));
+  json_array_foreach(headers, ix, header) {
+    value = json_string_value(json_object_get(header, "value"));
+    if (!value) value = "";
+    har_put_u16(capture->raw, ids[ix]);
+    har_put_u32(capture->raw, (guint32)strlen(value));
+    g_byte_array_append(capture->raw, (const guint8 *)value, strlen(value));
+  }
+}
+
+static guint16 *
+har_capture_intern_headers(HarCapture * capture, json_t * headers)
+{
+  int ix;
+  json_t * header;
+  const char * name;
+  guint16 * ids = g_new0(guint16, json_array_size(headers) + 1);
+
+  json_array_foreach(headers, ix, header) {
+    name = json_string_value(json_object_get(header, "name"));
+    ids[ix] = har_capture_name(capture, name ? name : "");
+  }
+  return ids;
+}
+
+/*
+ * har_capture_skeleton:
+ *
+ * The entry as compact JSON, without the headers, which
+ * har_capture_add writes apart, with their names interned.
+ */
+gchar *
+har_capture_skeleton(json_t * entry)
+{
+  const char * parts[] = { "request", "response" };
+  json_t * headers[2];
+  json_t * part;
+  gchar * text;
+  int ix;
+
+  for (ix = 0; ix < 2; ix++) {
+    part = json_object_get(entry, parts[ix]);
+    headers[ix] = json_incref(json_object_get(part, "headers"));
+    if (headers[ix]) json_object_del(part, "headers");
+  }
+  text = json_dumps(entry, JSON_SORT_KEYS | JSON_COMPACT);
+  for (ix = 0; ix < 2; ix++) {
+    if (headers[ix]) {
+      json_object_set_new(json_object_get(entry, parts[ix]), "headers", headers[ix]);
+    }
+  }
+  return text;
+}
+
+/*
+ * har_capture_add:
+ *
+ * Appends one entry to the current block, after the names
+ * of its headers, and writes the block out once it is
+ * --capture-block-size long.
+ */
+int
+har_capture_add(HarCapture * capture, int index, int hop, const char * skeleton,
+                json_t * request_headers, json_t * response_headers, GByteArray * body)
+{
+  guint32 offset;
+  guint16 * request_ids;
+  guint16 * response_ids;
+  gsize len = strlen(skeleton);
+  guint32 record_len;
+
+  if (json_array_size(request_headers) + json_array_size(response_headers) +
+      g_hash_table_size(capture->names) > HAR_CAPTURE_NAMES_MAX) {
+    har_capture_flush(capture);
+  }
+  request_ids = har_capture_intern_headers(capture, request_headers);
+  response_ids = har_capture_intern_headers(capture, response_headers);
+
+  offset = capture->raw->len;
+  g_array_append_val(capture->offsets, offset);
+  har_put_u32(capture->raw, 0);
+  g_byte_array_append(capture->raw, (const guint8 *)"e", 1);
+  har_put_u32(capture->raw, (guint32)index);
+  har_put_u16(capture->raw, (guint16)hop);
+  har_put_u32(capture->raw, (guint32)len);
+  g_byte_array_append(capture->raw, (const guint8 *)skeleton, len);
+  har_capture_put_headers(capture, request_headers, request_ids);
+  har_capture_put_headers(capture, response_headers, response_ids);
+  g_byte_array_append(capture->raw, (const guint8 *)(body ? "\1" : "\0"), 1);
+  har_put_u32(capture->raw, body ? body->len : 0);
+  if (body) {
+    g_byte_array_append(capture->raw, body->data, body->len);
+  }
+
+  /* the length goes in front of the record */
+  record_len = capture->raw->len - offset - 4;
+  capture->raw->data[offset] = record_len & 0xff;
+  capture->raw->data[offset + 1] = (record_len >> 8) & 0xff;
+  capture->raw->data[offset + 2] = (record_len >> 16) & 0xff;
+  capture->raw->data[offset + 3] = record_len >> 24;
+
+  g_free(request_ids);
+  g_free(response_ids);
+  if (capture->raw->len >= capture->block_size) {
+    return har_capture_flush(capture);
+  }
+  return capture->status;
+}
+
+/* writes the log (without its entries) and the last block */
+int
+har_capture_close(HarCapture * capture, json_t * log)
+{
+  json_t * copy;
+  gchar * text;
+  int status;
+
+  if (log) {
+    copy = json_copy(log);
+    json_object_del(copy, "entries");
+    text = json_dumps(copy, JSON_SORT_KEYS | JSON_COMPACT);
+    har_put_u32(capture->raw, (guint32)(1 + strlen(text)));
+    g_byte_array_append(capture->raw, (const guint8 *)"l", 1);
+    g_byte_array_append(capture->raw, (const guint8 *)text, strlen(text));
+    free(text);
+    json_decref(copy);
+  }
+  status = har_capture_flush(capture);
+
+  fclose(capture->stream);
+  g_byte_array_free(capture->raw, TRUE);
+  g_array_free(capture->offsets, TRUE);
+  g_hash_table_destroy(capture->names);
+  memset(capture, 0, sizeof(*capture));
+  return status;
+}
+
+/*
+ * HarCaptureReader:
+ *
+ * Reads a capture one block at a time.
+ */
+typedef struct _HarCaptureReader {
+  FILE * stream;
+  HarCaptureBlock block;
+  GByteArray * stored;
+  GByteArray * raw;
+  GPtrArray * names;
+  gboolean torn;
+} HarCaptureReader;
+
+/* 1 for a block, 0 at the end, and -1 for a block that cannot be read */
+static int
+har_capture_reader_next(HarCaptureReader * reader, gboolean load)
+{
+  int ret = har_capture_read_block_header(reader->stream, &reader->block);
+
+  if (ret < 0) {
+    reader->torn = TRUE;
+  }
+  if (ret <= 0) return ret;
+  if (!load) {
+    return fseek(reader->stream, reader->block.stored_len, SEEK_CUR) == 0 ? 1 : -1;
+  }
+
+  g_byte_array_set_size(reader->stored, reader->block.stored_len);
+  if (fread(reader->stored->data, 1, reader->block.stored_len, reader->stream) != reader->block.stored_len ||
+      (guint32)crc32(0L, reader->stored->data, reader->stored->len) != reader->block.crc ||
+      har_capture_uncompress(&reader->block, reader->stored->data, reader->raw) != HAR_OK) {
+    reader->torn = TRUE;
+    return -1;
+  }
+  g_ptr_array_set_size(reader->names, 0);
+  return 1;
+}
+
+static json_t *
+har_capture_read_headers(HarCaptureReader * reader, const guint8 ** p, const guint8 * end)
+{
+  json_t * headers = json_array();
+  guint16 count;
+  guint16 id;
+  guint32 len;
+
+  if (end - *p < 2) return headers;
+  count = har_get_u16(*p);
+  *p += 2;
+  while (count-- > 0 && end - *p >= 6) {
+    id = har_get_u16(*p);
+    len = har_get_u32(*p + 2);
+    *p += 6;
+    if ((gsize)(end - *p) < len) break;
+    json_array_append_new(headers,
+                          json_pack("{s:s,s:s%}",
+                                    "name", id < reader->names->len ? (const char *)g_ptr_array_index(reader->names, id) : "",
+                                    "value", (const char *)*p, (size_t)len));
+    *p += len;
+  }
+  return headers;
+}
+
+/* turns an entry record back into the entry that harcurl would have written */
+static json_t *
+har_capture_read_entry(HarCaptureReader * reader, const guint8 * p, const guint8 * end)
+{
+  json_t * entry;
+  json_t * req;
+  json_t * resp;
+  json_t * headers;
+  json_error_t error;
+  guint32 len;
+  GByteArray * body;
+
+  if (end - p < 10) return NULL;
+  len = har_get_u32(p + 6);
+  p += 10;
+  if ((gsize)(end - p) < len) return NULL;
+  entry = json_loadb((const char *)p, len, 0, &error);
+  p += len;
+  if (!entry) return NULL;
+
+  req = json_object_get(entry, "request");
+  resp = json_object_get(entry, "response");
+  headers = har_capture_read_headers(reader, &p, end);
+  if (req) json_object_set(req, "headers", headers);
+  json_decref(headers);
+  headers = har_capture_read_headers(reader, &p, end);
+  if (resp) json_object_set(resp, "headers", headers);
+  json_decref(headers);
+
+  if (end - p >= 5 && p[0] && json_object_get(resp, "content")) {
+    len = har_get_u32(p + 1);
+    p += 5;
+    if ((gsize)(end - p) >= len) {
+      body = g_byte_array_sized_new(len);
+      g_byte_array_append(body, p, len);
+      har_response_content_from_byte_array(resp, body);
+      g_byte_array_free(body, TRUE);
+    }
+  }
+  return entry;
+}
+
+/*
+ * har_capture_reader_records:
+ *
+ * Goes through the records of the block up to (not
+ * including) the entry at offset "stop", or all of them
+ * when "stop" is -1, and calls "each" for every entry and
+ * for the log (with index -1).
+ */
+typedef void (*HarCaptureEach)(json_t * obj, int index, gpointer data);
+
+static void
+har_capture_reader_records(HarCaptureReader * reader, gint64 stop, HarCaptureEach each, gpointer data)
+{
+  const guint8 * p = reader->raw->data;
+  const guint8 * end = p + reader->raw->len - 4 * reader->block.count;
+  guint32 len;
+  json_t * obj;
+  json_error_t error;
+
+  while (end - p >= 5) {
+    len = har_get_u32(p);
+    if (len < 1 || (gsize)(end - p - 4) < len) break;
+    if (stop >= 0 && p - reader->raw->data == stop) break;
+    switch (p[4]) {
+    case 'n':
+      if (len >= 3) {
+        guint16 id = har_get_u16(p + 5);
+        if (id >= reader->names->len) g_ptr_array_set_size(reader->names, id + 1);
+        g_free(g_ptr_array_index(reader->names, id));
+        g_ptr_array_index(reader->names, id) = g_strndup((const gchar *)p + 7, len - 3);
+      }
+      break;
+    case 'e':
+      if (stop < 0 && (obj = har_capture_read_entry(reader, p + 5, p + 4 + len))) {
+        each(obj, (int)har_get_u32(p + 5), data);
+        json_decref(obj);
+      }
+      break;
+    case 'l':
+      if (stop < 0 && (obj = json_loadb((const char *)p + 5, len - 1, 0, &error))) {
+        each(obj, -1, data);
+        json_decref(obj);
+      }
+      break;
+    }
+    p += 4 + len;
+  }
+}
+
+typedef struct _HarConvert {
+  gboolean ndjson;
+  int written;
+  json_t * log;
+} HarConvert;
+
+static void
+har_convert_each(json_t * obj, int index, gpointer data)
+{
+  HarConvert * convert = (HarConvert *)data;
+
+  if (index < 0) {
+    json_decref(convert->log);
+    convert->log = json_incref(obj);
+    return;
+  }
+  if (convert->ndjson) {
+    json_dumpf(obj, stdout, JSON_SORT_KEYS | JSON_COMPACT);
+    fputc('\n', stdout);
+  } else {
+    if (convert->written > 0) {
+      fputs(",\n", stdout);
+    }
+    json_dumpf(obj, stdout, JSON_SORT_KEYS | JSON_INDENT(2));
+  }
+  convert->written++;
+}
+
+/*
+ * har_capture_convert_main:
+ *
+ * harcurl convert [--ndjson] [--entry N] FILE
+ *
+ * Writes the capture as a HAR log, or as one entry per line.
+ * With --entry N, only the N-th entry (from 0) of the log it
+ * would write is written, which is the N-th record of the
+ * file, found from the block headers and the index of its
+ * block, without reading the blocks before it.
+ */
+int
+har_capture_convert_main(int argc, char * argv[])
+{
+  gboolean ndjson = FALSE;
+  gint64 entry = -1;
+  int ret;
+  int status = HAR_OK;
+  GError * option_error = NULL;
+  GOptionContext * options;
+  HarCaptureReader reader;
+  HarConvert convert;
+
+  GOptionEntry option_entries[] = {
+    { "ndjson", 0, 0, G_OPTION_ARG_NONE, &ndjson,
+      "Write one entry per line, instead of a HAR log", NULL },
+    { "entry", 0, 0, G_OPTION_ARG_INT64, &entry,
+      "Only write the N-th entry of the converted log, counting from 0 (every hop of --location is one)", "N" },
+    NULL
+  };
+
+  options = g_option_context_new("convert FILE");
+  g_option_context_add_main_entries(options, option_entries, NULL);
+  if (g_option_context_parse(options, &argc, &argv, &option_error) != TRUE || argc != 2) {
+    fprintf(stderr, "usage: harcurl convert [--ndjson] [--entry N] FILE\n");
+    g_option_context_free(options);
+    return HAR_ERROR_UNKNOWN;
+  }
+  g_option_context_free(options);
+
+  memset(&reader, 0, sizeof(reader));
+  memset(&convert, 0, sizeof(convert));
+  convert.ndjson = ndjson;
+  reader.stream = fopen(argv[1], "rb");
+  if (!reader.stream) {
+    fprintf(stderr, "unable to open %s\n", argv[1]);
+    return HAR_ERROR_CAPTURE;
+  }
+  if ((status = har_capture_read_file_header(reader.stream)) != HAR_OK) {
+    fclose(reader.stream);
+    return status;
+  }
+  reader.stored = g_byte_array_new();
+  reader.raw = g_byte_array_new();
+  reader.names = g_ptr_array_new_with_free_func(g_free);
+
+  if (entry >= 0) {
+    status = HAR_ERROR_CAPTURE;
+    while ((ret = har_capture_reader_next(&reader, FALSE)) > 0) {
+      if ((guint64)entry < reader.block.first + reader.block.count) break;
+    }
+    if (ret > 0) {
+      fseek(reader.stream, -(long)reader.block.stored_len - HAR_CAPTURE_BLOCK_HEADER_SIZE, SEEK_CUR);
+      if (har_capture_reader_next(&reader, TRUE) > 0 &&
+          reader.raw->len >= 4 * (gsize)reader.block.count) {
+        /* the record has to fit before the index, as in har_capture_reader_records */
+        gsize records = reader.raw->len - 4 * (gsize)reader.block.count;
+        guint32 offset = har_get_u32(reader.raw->data + records + 4 * (entry - reader.block.first));
+        const guint8 * p = reader.raw->data + offset;
+        json_t * obj;
+        har_capture_reader_records(&reader, offset, NULL, NULL);
+        if ((gsize)offset + 5 <= records && p[4] == 'e' && har_get_u32(p) >= 1 &&
+            4 + (gsize)har_get_u32(p) <= records - offset &&
+            (obj = har_capture_read_entry(&reader, p + 5, p + 4 + har_get_u32(p)))) {
+          json_dumpf(obj, stdout, JSON_SORT_KEYS | (ndjson ? JSON_COMPACT : JSON_INDENT(2)));
+          fputc('\n', stdout);
+          json_decref(obj);
+          status = HAR_OK;
+        }
+      }
+      if (status != HAR_OK) {
+        fprintf(stderr, "entry %" G_GINT64_FORMAT " of the capture is broken\n", entry);
+      }
+    } else {
+      fprintf(stderr, "the capture has no entry %" G_GINT64_FORMAT "\n", entry);
+    }
+  } else {
+    if (!ndjson) {
+      har_log_write_head(stdout);
+    }
+    while (har_capture_reader_next(&reader, TRUE) > 0) {
+      har_capture_reader_records(&reader, -1, &har_convert_each, &convert);
+    }
+    if (!ndjson) {
+      if (!convert.log) {
+        convert.log = json_pack("{s:s}", "version", "1.2");
+      }
+      har_log_write_tail(stdout, convert.log);
+    }
+  }
+  fflush(stdout);
+
+  if (reader.torn) {
+    fprintf(stderr, "the capture ends with a block that cannot be read, which was skipped\n");
+  }
+  json_decref(convert.log);
+  g_byte_array_free(reader.stored, TRUE);
+  g_byte_array_free(reader.raw, TRUE);
+  g_ptr_array_free(reader.names, TRUE);
+  fclose(reader.stream);
+  return status;
+}
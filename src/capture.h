@@ -0,0 +1,77 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+#ifndef HARCURL_CAPTURE_H
+#define HARCURL_CAPTURE_H
+
+#include <stdio.h>
+#include <glib.h>
+#include <jansson.h>
+
+/*
+ * The capture format:
+ *
+ * All integers are little-endian. A file is a header and
+ * any number of blocks, which are only ever appended, and
+ * written whole, so that a crashed run leaves at most a
+ * torn last block, which readers (and the next writer)
+ * drop. Every block can be read on its own.
+ *
+ *   file   = "HCAP" u32:version block*
+ *   block  = "HBLK" u8:codec u8[3] u32:count u64:first
+ *            u32:raw_len u32:stored_len u32:crc32(stored) stored
+ *   raw    = record* u32:offset[count]
+ *   record = u32:len u8:type body      (len counts type and body)
+ *
+ * "stored" is "raw", compressed with the codec. "first" is
+ * the number of entry records in the blocks before, and
+ * "offset" is where each of the "count" entry records of the
+ * block starts in "raw", so that the N-th record of the file
+ * can be found from the block headers alone. Records are
+ * numbered as the entries of the converted log are, which is
+ * not the index of the input entry: with --location every hop
+ * is a record, and runs appended to the same file follow each
+ * other.
+ *
+ * Records are 'n' (u16:id name), which interns a header name
+ * until the end of the block, 'e' (an entry, see capture.c),
+ * and 'l' (the log, as JSON, without the entries).
+ */
+#define HAR_CAPTURE_VERSION 1
+
+typedef enum _HarCaptureCodec {
+  HAR_CAPTURE_NONE = 0,
+  HAR_CAPTURE_GZIP,
+  HAR_CAPTURE_ZSTD,
+} HarCaptureCodec;
+
+typedef struct _HarCapture {
+  FILE * stream;
+  HarCaptureCodec codec;
+  gsize block_size;
+  GByteArray * raw;
+  GArray * offsets;
+  GHashTable * names;
+  guint64 entries;
+  guint64 blocks;
+  int status;
+} HarCapture;
+
+int har_capture_codec_from_name(const char * name, HarCaptureCodec * codec);
+int har_capture_open(HarCapture * capture, const char * path, HarCaptureCodec codec, gsize block_size);
+gchar * har_capture_skeleton(json_t * entry);
+/* these return the first error of the capture, which har_capture_close returns as well */
+int har_capture_add(HarCapture * capture, int index, int hop, const char * skeleton,
+                    json_t * request_headers, json_t * response_headers, GByteArray * body);
+int har_capture_close(HarCapture * capture, json_t * log);
+
+/* harcurl convert [--ndjson] [--entry N] FILE */
+int har_capture_convert_main(int argc, char * argv[]);
+
+#endif /* HARCURL_CAPTURE_H */
@@ -0,0 +1,412 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+/*
+ * --compare: the pairs of entries sent to two targets, and
+ * the paired statistics of their timings. See compare.h.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include <glib.h>
+#include <jansson.h>
+
+#include "config.h"
+#include "harcurl.h"
+#include "compare.h"
+#include "headers.h"
+
+gint
+har_compare_double(gconstpointer a, gconstpointer b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static const char * har_compare_phases[HAR_COMPARE_PHASES] = {
+  "time", "dns", "connect", "ssl", "send", "wait", "receive"
+};
+
+/* headers that are expected to differ between any two responses */
+static const char * har_compare_ignored_headers[] = {
+  "age", "connection", "date", "expires", "keep-alive", "last-modified",
+  "set-cookie", "x-request-id", "x-trace-id"
+};
+
+void
+har_compare_init(HarCompare * compare, const char * a, const char * b, HarCompareMode mode)
+{
+  int ix;
+
+  memset(compare, 0, sizeof(*compare));
+  compare->targets[0] = g_strdup(a);
+  compare->targets[1] = g_strdup(b);
+  compare->mode = mode;
+  for (ix = 0; ix < HAR_COMPARE_PHASES; ix++) {
+    compare->samples[0][ix] = g_array_new(FALSE, FALSE, sizeof(double));
+    compare->samples[1][ix] = g_array_new(FALSE, FALSE, sizeof(double));
+  }
+  compare->pairs = json_array();
+}
+
+void
+har_compare_clear(HarCompare * compare)
+{
+  int ix;
+
+  for (ix = 0; ix < HAR_COMPARE_PHASES; ix++) {
+    g_array_free(compare->samples[0][ix], TRUE);
+    g_array_free(compare->samples[1][ix], TRUE);
+  }
+  g_free(compare->targets[0]);
+  g_free(compare->targets[1]);
+  json_decref(compare->first);
+  json_decref(compare->pairs);
+  memset(compare, 0, sizeof(*compare));
+}
+
+/*
+ * har_url_rebase:
+ *
+ * Returns url with the scheme, host and port of base, and
+ * the path of base (if any) in front of its own path.
+ */
+gchar *
+har_url_rebase(const char * url, const char * base)
+{
+  CURLU * h = curl_url();
+  CURLU * b = curl_url();
+  char * path = NULL;
+  char * query = NULL;
+  char * base_path = NULL;
+  char * rebased = NULL;
+  gchar * prefix;
+  gchar * joined;
+  gchar * result = NULL;
+
+  if (curl_url_set(h, CURLUPART_URL, url, 0) == CURLUE_OK &&
+      curl_url_set(b, CURLUPART_URL, base, 0) == CURLUE_OK &&
+      curl_url_get(h, CURLUPART_PATH, &path, 0) == CURLUE_OK &&
+      curl_url_get(b, CURLUPART_PATH, &base_path, 0) == CURLUE_OK) {
+    curl_url_get(h, CURLUPART_QUERY, &query, 0);
+    prefix = g_strdup(base_path);
+    while (*prefix && prefix[strlen(prefix) - 1] == '/') {
+      prefix[strlen(prefix) - 1] = '\0';
+    }
+    joined = g_strconcat(prefix, path, NULL);
+    curl_url_set(b, CURLUPART_PATH, joined, 0);
+    curl_url_set(b, CURLUPART_QUERY, query, 0);
+    if (curl_url_get(b, CURLUPART_URL, &rebased, 0) == CURLUE_OK) {
+      result = g_strdup(rebased);
+    }
+    g_free(prefix);
+    g_free(joined);
+  }
+
+  curl_free(path);
+  curl_free(query);
+  curl_free(base_path);
+  curl_free(rebased);
+  curl_url_cleanup(h);
+  curl_url_cleanup(b);
+  return result;
+}
+
+/*
+ * har_compare_expand:
+ *
+ * Returns the entries of the run, two for every entry. The
+ * Host header is dropped, so that libcurl sends the one of
+ * the target.
+ */
+json_t *
+har_compare_expand(HarCompare * compare, json_t * entries)
+{
+  int ix;
+  int jx;
+  int kx;
+  int target;
+  json_t * entry;
+  json_t * copy;
+  json_t * req;
+  json_t * headers;
+  json_t * expanded = json_array();
+  gchar * url;
+
+  json_array_foreach(entries, ix, entry) {
+    for (jx = 0; jx < 2; jx++) {
+      target = (ix % 2) ? 1 - jx : jx;
+      copy = json_deep_copy(entry);
+      req = json_object_get(copy, "request");
+      url = har_url_rebase(json_string_value(json_object_get(req, "url")), compare->targets[target]);
+      if (url) {
+        json_object_set_new(req, "url", json_string(url));
+        g_free(url);
+      }
+      headers = json_object_get(req, "headers");
+      for (kx = (int)json_array_size(headers) - 1; kx >= 0; kx--) {
+        json_t * name = json_object_get(json_array_get(headers, kx), "name");
+        if (har_header_lookup(json_string_value(name), json_string_length(name)) == HAR_HEADER_HOST) {
+          json_array_remove(headers, kx);
+        }
+      }
+      json_object_set_new(copy, "_compare",
+                          json_pack("{s:i,s:s}", "pair", ix, "target", target ? "b" : "a"));
+      json_array_append_new(expanded, copy);
+    }
+  }
+  return expanded;
+}
+
+/* adds the digest of the decoded body to entry._compare, on a worker */
+void
+har_compare_digest(json_t * entry, GByteArray * body)
+{
+  json_t * obj = json_object_get(entry, "_compare");
+  gchar * digest;
+  gchar * value;
+
+  if (!obj || !body) return;
+  digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256, body->data, body->len);
+  value = g_strconcat("sha256:", digest, NULL);
+  json_object_set_new(obj, "bodyDigest", json_string(value));
+  g_free(value);
+  g_free(digest);
+}
+
+/* lower-case name => values, without the ignored headers */
+static GHashTable *
+har_compare_headers(json_t * headers)
+{
+  GHashTable * table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  json_t * header;
+  gchar * name;
+  gchar * value;
+  const char * previous;
+  int ix;
+  int jx;
+
+  json_array_foreach(headers, ix, header) {
+    name = g_ascii_strdown(json_string_value(json_object_get(header, "name")), -1);
+    for (jx = 0; jx < G_N_ELEMENTS(har_compare_ignored_headers); jx++) {
+      if (!strcmp(name, har_compare_ignored_headers[jx])) break;
+    }
+    if (jx < G_N_ELEMENTS(har_compare_ignored_headers)) {
+      g_free(name);
+      continue;
+    }
+    previous = g_hash_table_lookup(table, name);
+    value = previous ?
+      g_strconcat(previous, "\n", json_string_value(json_object_get(header, "value")), NULL) :
+      g_strdup(json_string_value(json_object_get(header, "value")));
+    g_hash_table_replace(table, name, value);
+  }
+  return table;
+}
+
+/* the names of the headers that only one of them has, or with other values */
+static void
+har_compare_headers_differences(json_t * differences, json_t * a, json_t * b)
+{
+  GHashTable * ha = har_compare_headers(a);
+  GHashTable * hb = har_compare_headers(b);
+  GPtrArray * names = g_ptr_array_new_with_free_func(g_free);
+  GHashTableIter iter;
+  gpointer name;
+  gpointer value;
+  const char * other;
+  int ix;
+
+  g_hash_table_iter_init(&iter, ha);
+  while (g_hash_table_iter_next(&iter, &name, &value)) {
+    other = g_hash_table_lookup(hb, name);
+    if (!other || strcmp(other, value)) {
+      g_ptr_array_add(names, g_strconcat("header:", name, NULL));
+    }
+  }
+  g_hash_table_iter_init(&iter, hb);
+  while (g_hash_table_iter_next(&iter, &name, &value)) {
+    if (!g_hash_table_contains(ha, name)) {
+      g_ptr_array_add(names, g_strconcat("header:", name, NULL));
+    }
+  }
+  g_ptr_array_sort(names, (GCompareFunc)&har_strcmp_indirect);
+  for (ix = 0; ix < names->len; ix++) {
+    json_array_append_new(differences, json_string(g_ptr_array_index(names, ix)));
+  }
+
+  g_ptr_array_free(names, TRUE);
+  g_hash_table_destroy(ha);
+  g_hash_table_destroy(hb);
+}
+
+/* the phase of an entry, or -1 when it does not apply */
+static double
+har_compare_phase(json_t * entry, int phase)
+{
+  json_t * value = phase == 0 ?
+    json_object_get(entry, "time") :
+    json_object_get(json_object_get(entry, "timings"), har_compare_phases[phase]);
+  return json_is_number(value) ? json_number_value(value) : -1;
+}
+
+/*
+ * har_compare_add:
+ *
+ * Called by the writer with the final hop of every entry.
+ * Keeps the first entry of a pair, and compares the second
+ * one with it.
+ */
+void
+har_compare_add(HarCompare * compare, json_t * entry)
+{
+  json_t * obj = json_object_get(entry, "_compare");
+  json_t * first = compare->first;
+  json_t * ab[2];
+  json_t * pair;
+  json_t * delta;
+  json_t * differences;
+  json_t * resp[2];
+  double values[2];
+  int target;
+  int ix;
+  int jx;
+
+  if (!obj) return;
+  if (!first || json_integer_value(json_object_get(json_object_get(first, "_compare"), "pair")) !=
+      json_integer_value(json_object_get(obj, "pair"))) {
+    json_decref(compare->first);
+    compare->first = json_incref(entry);
+    return;
+  }
+
+  target = !strcmp(json_string_value(json_object_get(obj, "target")), "b");
+  ab[target] = entry;
+  ab[1 - target] = first;
+  delta = json_object();
+  differences = json_array();
+  for (ix = 0; ix < HAR_COMPARE_PHASES; ix++) {
+    for (jx = 0; jx < 2; jx++) {
+      values[jx] = har_compare_phase(ab[jx], ix);
+    }
+    if (values[0] < 0 || values[1] < 0) continue;
+    for (jx = 0; jx < 2; jx++) {
+      g_array_append_val(compare->samples[jx][ix], values[jx]);
+    }
+    json_object_set_new(delta, har_compare_phases[ix], json_real(values[1] - values[0]));
+  }
+
+  for (jx = 0; jx < 2; jx++) {
+    resp[jx] = json_object_get(ab[jx], "response");
+  }
+  if (json_integer_value(json_object_get(resp[0], "status")) !=
+      json_integer_value(json_object_get(resp[1], "status"))) {
+    json_array_append_new(differences, json_string("status"));
+  }
+  har_compare_headers_differences(differences,
+                                  json_object_get(resp[0], "headers"),
+                                  json_object_get(resp[1], "headers"));
+  if (!json_equal(json_object_get(json_object_get(ab[0], "_compare"), "bodyDigest"),
+                  json_object_get(json_object_get(ab[1], "_compare"), "bodyDigest"))) {
+    json_array_append_new(differences, json_string("body"));
+  }
+
+  pair = json_pack("{s:O,s:O,s:{s:O,s:O},s:{s:O,s:O},s:o}",
+                   "pair", json_object_get(obj, "pair"),
+                   "url", json_object_get(json_object_get(ab[0], "request"), "url"),
+                   "a", "status", json_object_get(resp[0], "status"), "time", json_object_get(ab[0], "time"),
+                   "b", "status", json_object_get(resp[1], "status"), "time", json_object_get(ab[1], "time"),
+                   "delta", delta);
+  if (json_array_size(differences)) {
+    compare->differences++;
+    json_object_set(pair, "differences", differences);
+  }
+  json_array_append_new(compare->pairs, pair);
+
+  json_decref(differences);
+  json_decref(compare->first);
+  compare->first = NULL;
+}
+
+/* two-sided 95% quantiles of Student's t, for 1 to 30 degrees of freedom */
+static const double har_compare_t95[] = {
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+/*
+ * har_compare_to_json:
+ *
+ * For every phase, the mean of both targets, and the mean,
+ * median and 95% confidence interval of the paired deltas.
+ */
+json_t *
+har_compare_to_json(HarCompare * compare)
+{
+  json_t * obj = json_object();
+  json_t * phases = json_object();
+  GArray * deltas;
+  double sum[2];
+  double mean;
+  double var;
+  double d;
+  double half;
+  guint n;
+  guint ix;
+  int phase;
+
+  for (phase = 0; phase < HAR_COMPARE_PHASES; phase++) {
+    n = compare->samples[0][phase]->len;
+    if (!n) continue;
+    deltas = g_array_sized_new(FALSE, FALSE, sizeof(double), n);
+    sum[0] = sum[1] = 0;
+    for (ix = 0; ix < n; ix++) {
+      sum[0] += g_array_index(compare->samples[0][phase], double, ix);
+      sum[1] += g_array_index(compare->samples[1][phase], double, ix);
+      d = g_array_index(compare->samples[1][phase], double, ix) -
+        g_array_index(compare->samples[0][phase], double, ix);
+      g_array_append_val(deltas, d);
+    }
+    mean = (sum[1] - sum[0]) / n;
+    var = 0;
+    for (ix = 0; ix < n; ix++) {
+      d = g_array_index(deltas, double, ix) - mean;
+      var += d * d;
+    }
+    half = n > 1 ?
+      (n - 1 <= G_N_ELEMENTS(har_compare_t95) ? har_compare_t95[n - 2] : 1.960) * sqrt(var / (n - 1) / n) :
+      0;
+    g_array_sort(deltas, &har_compare_double);
+    json_object_set_new(phases, har_compare_phases[phase],
+                        json_pack("{s:i,s:f,s:f,s:{s:f,s:f,s:[f,f]}}",
+                                  "n", (int)n,
+                                  "a", sum[0] / n,
+                                  "b", sum[1] / n,
+                                  "delta",
+                                  "mean", mean,
+                                  "median", n % 2 ?
+                                  g_array_index(deltas, double, n / 2) :
+                                  0.5 * (g_array_index(deltas, double, n / 2 - 1) + g_array_index(deltas, double, n / 2)),
+                                  "ci95", mean - half, mean + half));
+    g_array_free(deltas, TRUE);
+  }
+
+  json_object_set_new(obj, "a", json_string(compare->targets[0]));
+  json_object_set_new(obj, "b", json_string(compare->targets[1]));
+  json_object_set_new(obj, "mode", json_string(compare->mode == HAR_COMPARE_CONCURRENT ? "concurrent" : "interleaved"));
+  json_object_set_new(obj, "differences", json_integer(compare->differences));
+  json_object_set_new(obj, "phases", phases);
+  json_object_set(obj, "pairs", compare->pairs);
+  return obj;
+}
@@ -0,0 +1,56 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+#ifndef HARCURL_COMPARE_H
+#define HARCURL_COMPARE_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*
+ * HarCompare:
+ *
+ * With --compare A --compare B, every entry is sent to both
+ * targets, as the adjacent entries 2i and 2i+1 of the run,
+ * with the origin of the URL rewritten. Target A goes first
+ * in even pairs, and target B in odd pairs, so that neither
+ * always benefits from going first. The writer sees both
+ * entries of a pair in order, and compares their final hops:
+ * the timings, and the status, headers and body digest of
+ * their responses. Deltas are always B minus A.
+ */
+typedef enum _HarCompareMode {
+  HAR_COMPARE_INTERLEAVED = 0,
+  HAR_COMPARE_CONCURRENT,
+} HarCompareMode;
+
+#define HAR_COMPARE_PHASES 7
+
+typedef struct _HarCompare {
+  gchar * targets[2];
+  HarCompareMode mode;
+  GArray * samples[2][HAR_COMPARE_PHASES];
+  json_t * first;
+  json_t * pairs;
+  int differences;
+} HarCompare;
+
+void har_compare_init(HarCompare * compare, const char * a, const char * b, HarCompareMode mode);
+void har_compare_clear(HarCompare * compare);
+json_t * har_compare_expand(HarCompare * compare, json_t * entries);
+void har_compare_digest(json_t * entry, GByteArray * body);
+void har_compare_add(HarCompare * compare, json_t * entry);
+json_t * har_compare_to_json(HarCompare * compare);
+
+gchar * har_url_rebase(const char * url, const char * base);
+
+/* for g_array_sort() of doubles */
+gint har_compare_double(gconstpointer a, gconstpointer b);
+
+#endif /* HARCURL_COMPARE_H */
@@ -0,0 +1,123 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+#ifndef HARCURL_H
+#define HARCURL_H
+
+#include <curl/curl.h>
+#include <glib.h>
+#include <jansson.h>
+
+/*
+ * HarStatusCode:
+ * 
+ * This enumeration is designed to work with
+ * libcurl status codes. The maximum status code
+ * that libcurl uses at the time of this writing
+ * is 89, so 128 should be enough for future
+ * expansions, if libcurl wants to do so.
+ */
+typedef enum _HarStatusCode {
+  HAR_OK = CURLE_OK,
+  
+  HAR_ERROR_UNKNOWN = 0x80,   /* 128 */
+  HAR_ERROR_NO_REQUEST,       /* 129 */
+  HAR_ERROR_NO_RESPONSE,      /* 130 */
+  HAR_ERROR_NO_METHOD,        /* 131 */
+  HAR_ERROR_NO_URL,           /* 132 */
+  HAR_ERROR_TEXT_AND_PARAMS,  /* 133 */
+  HAR_ERROR_WITH_CURL,        /* 134 = libcurl returned an error */
+  HAR_ERROR_WITH_HTTP,        /* 135 = HTTP protocol violation */
+  HAR_ERROR_WITH_JANSSON,     /* 136 = libjansson returned an error */
+  HAR_ERROR_WITH_JSON,        /* 137 = JSON was unparsable */
+  HAR_ERROR_NETWORK_PROFILE,  /* 138 = --network or entry._network was invalid */
+  HAR_ERROR_CAPTURE,          /* 139 = the capture file was unusable */
+  HAR_ERROR_RESUME,           /* 140 = the journal of --resume was unusable */
+  
+  HAR_ERROR_LAST,             /* 141 */
+} HarStatusCode;
+
+extern gboolean global_verbose;
+extern gboolean global_profile;
+extern gboolean global_capture;
+
+/*
+ * HarPhase:
+ *
+ * The internal stages of harcurl that --profile times,
+ * and that the harcurl:phase__start and harcurl:phase__done
+ * USDT probes mark (when built with <sys/sdt.h>), with the
+ * name of the phase and the index of the entry as arguments.
+ */
+typedef enum _HarPhase {
+  HAR_PHASE_LOAD = 0,
+  HAR_PHASE_SETOPT,
+  HAR_PHASE_PERFORM,
+  HAR_PHASE_GETINFO,
+  HAR_PHASE_HEADERS,
+  HAR_PHASE_DECOMPRESS,
+  HAR_PHASE_CONTENT,
+  HAR_PHASE_DUMP,
+
+  HAR_PHASE_LAST,
+} HarPhase;
+
+/* microseconds of wall and thread CPU time, summed per phase */
+typedef struct _HarProfile {
+  gint64 wall[HAR_PHASE_LAST];
+  gint64 cpu[HAR_PHASE_LAST];
+  guint count[HAR_PHASE_LAST];
+} HarProfile;
+
+typedef struct _HarPhaseClock {
+  gint64 wall;
+  gint64 cpu;
+} HarPhaseClock;
+
+void har_phase_begin(HarPhaseClock * clock, HarPhase phase, int index);
+void har_phase_end(HarProfile * profile, HarPhaseClock * clock, HarPhase phase, int index);
+void har_profile_add(HarProfile * dest, const HarProfile * src);
+json_t * har_profile_to_json(const HarProfile * profile, gboolean counts);
+
+int har_strerror(int status, char * strerrbuf, size_t buflen);
+
+/* for g_ptr_array_sort() of strings */
+gint har_strcmp_indirect(gconstpointer a, gconstpointer b);
+
+/* "scheme://host:port" */
+gchar * har_url_to_origin(const char * url, gchar ** host, long * port);
+
+/* HAR to libcurl */
+struct curl_slist * har_headers_to_curl_slist(json_t * headers);
+int har_entry_prepare(json_t * entry);
+int har_entry_to_curl_easy_setopt(json_t * obj, CURL * easy,
+                                  GByteArray * harbodyin,
+                                  GByteArray * harheadout,
+                                  GByteArray * harbodyout);
+
+/* libcurl to HAR */
+void har_headers_from_text(json_t * headers, const char * s, size_t s_len);
+void har_response_content_from_byte_array(json_t * resp, GByteArray * bytes);
+int har_entry_from_curl_easy_getinfo(json_t * obj, CURL * easy);
+int har_entry_from_byte_arrays(json_t * obj,
+                               GByteArray * harheadout,
+                               GByteArray ** harbodyout,
+                               HarProfile * profile, int index);
+
+/* HAR logs */
+void har_log_write_head(FILE * stream);
+void har_log_write_tail(FILE * stream, json_t * log);
+
+/* Content-Encoding */
+int har_uncompress(GByteArray * dest, gconstpointer src_data, gsize src_len, int windowBits);
+int har_window_bits(const char * content_encoding);
+GBytes * har_bytes_uncompress(const GBytes * src, int windowBits);
+GByteArray * har_byte_array_uncompress(GByteArray * src, int windowBits);
+
+#endif /* HARCURL_H */
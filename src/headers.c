@@ -0,0 +1,241 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <jansson.h>
+
+#include "config.h"
+#include "headers.h"
+
+static const char * har_header_names[HAR_HEADER_LAST] = {
+  [HAR_HEADER_AUTHORITY] = ":authority",
+  [HAR_HEADER_METHOD] = ":method",
+  [HAR_HEADER_PATH] = ":path",
+  [HAR_HEADER_SCHEME] = ":scheme",
+  [HAR_HEADER_STATUS] = ":status",
+  [HAR_HEADER_ACCEPT_CHARSET] = "accept-charset",
+  [HAR_HEADER_ACCEPT_ENCODING] = "accept-encoding",
+  [HAR_HEADER_ACCEPT_LANGUAGE] = "accept-language",
+  [HAR_HEADER_ACCEPT_RANGES] = "accept-ranges",
+  [HAR_HEADER_ACCEPT] = "accept",
+  [HAR_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN] = "access-control-allow-origin",
+  [HAR_HEADER_AGE] = "age",
+  [HAR_HEADER_ALLOW] = "allow",
+  [HAR_HEADER_AUTHORIZATION] = "authorization",
+  [HAR_HEADER_CACHE_CONTROL] = "cache-control",
+  [HAR_HEADER_CONTENT_DISPOSITION] = "content-disposition",
+  [HAR_HEADER_CONTENT_ENCODING] = "content-encoding",
+  [HAR_HEADER_CONTENT_LANGUAGE] = "content-language",
+  [HAR_HEADER_CONTENT_LENGTH] = "content-length",
+  [HAR_HEADER_CONTENT_LOCATION] = "content-location",
+  [HAR_HEADER_CONTENT_RANGE] = "content-range",
+  [HAR_HEADER_CONTENT_TYPE] = "content-type",
+  [HAR_HEADER_COOKIE] = "cookie",
+  [HAR_HEADER_DATE] = "date",
+  [HAR_HEADER_ETAG] = "etag",
+  [HAR_HEADER_EXPECT] = "expect",
+  [HAR_HEADER_EXPIRES] = "expires",
+  [HAR_HEADER_FROM] = "from",
+  [HAR_HEADER_HOST] = "host",
+  [HAR_HEADER_IF_MATCH] = "if-match",
+  [HAR_HEADER_IF_MODIFIED_SINCE] = "if-modified-since",
+  [HAR_HEADER_IF_NONE_MATCH] = "if-none-match",
+  [HAR_HEADER_IF_RANGE] = "if-range",
+  [HAR_HEADER_IF_UNMODIFIED_SINCE] = "if-unmodified-since",
+  [HAR_HEADER_LAST_MODIFIED] = "last-modified",
+  [HAR_HEADER_LINK] = "link",
+  [HAR_HEADER_LOCATION] = "location",
+  [HAR_HEADER_MAX_FORWARDS] = "max-forwards",
+  [HAR_HEADER_PROXY_AUTHENTICATE] = "proxy-authenticate",
+  [HAR_HEADER_PROXY_AUTHORIZATION] = "proxy-authorization",
+  [HAR_HEADER_RANGE] = "range",
+  [HAR_HEADER_REFERER] = "referer",
+  [HAR_HEADER_REFRESH] = "refresh",
+  [HAR_HEADER_RETRY_AFTER] = "retry-after",
+  [HAR_HEADER_SERVER] = "server",
+  [HAR_HEADER_SET_COOKIE] = "set-cookie",
+  [HAR_HEADER_STRICT_TRANSPORT_SECURITY] = "strict-transport-security",
+  [HAR_HEADER_TRANSFER_ENCODING] = "transfer-encoding",
+  [HAR_HEADER_USER_AGENT] = "user-agent",
+  [HAR_HEADER_VARY] = "vary",
+  [HAR_HEADER_VIA] = "via",
+  [HAR_HEADER_WWW_AUTHENTICATE] = "www-authenticate",
+};
+
+/* "access-control-allow-origin" is the longest */
+#define HAR_HEADER_NAME_MAX 27
+
+/* open addressing, with at most half of the slots used */
+#define HAR_HEADER_SLOTS 128
+
+static guint8 har_header_slots[HAR_HEADER_SLOTS];
+static guint32 har_header_hashes[HAR_HEADER_LAST];
+static gsize har_header_ready = 0;
+
+/* FNV-1a, of the lower case name when fold is set */
+static inline guint32
+har_header_hash(const char * name, gsize len, gboolean fold)
+{
+  guint32 hash = 2166136261u;
+  gsize ix;
+
+  for (ix = 0; ix < len; ix++) {
+    hash ^= (guint8)(fold ? g_ascii_tolower(name[ix]) : name[ix]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void
+har_header_table_init(void)
+{
+  int header;
+  guint slot;
+
+  if (g_once_init_enter(&har_header_ready)) {
+    for (header = 1; header < HAR_HEADER_LAST; header++) {
+      if (!har_header_names[header]) continue;
+      har_header_hashes[header] = har_header_hash(har_header_names[header],
+                                                  strlen(har_header_names[header]), FALSE);
+      slot = har_header_hashes[header] & (HAR_HEADER_SLOTS - 1);
+      while (har_header_slots[slot]) {
+        slot = (slot + 1) & (HAR_HEADER_SLOTS - 1);
+      }
+      har_header_slots[slot] = (guint8)header;
+    }
+    g_once_init_leave(&har_header_ready, 1);
+  }
+}
+
+HarHeader
+har_header_lookup(const char * name, gsize len)
+{
+  guint32 hash;
+  guint slot;
+  HarHeader header;
+
+  if (!name || len == 0 || len > HAR_HEADER_NAME_MAX) {
+    return HAR_HEADER_UNKNOWN;
+  }
+  har_header_table_init();
+
+  hash = har_header_hash(name, len, TRUE);
+  for (slot = hash & (HAR_HEADER_SLOTS - 1);
+       (header = (HarHeader)har_header_slots[slot]) != HAR_HEADER_UNKNOWN;
+       slot = (slot + 1) & (HAR_HEADER_SLOTS - 1)) {
+    if (har_header_hashes[header] == hash &&
+        !g_ascii_strncasecmp(name, har_header_names[header], len) &&
+        har_header_names[header][len] == '\0') {
+      return header;
+    }
+  }
+  return HAR_HEADER_UNKNOWN;
+}
+
+const char *
+har_header_name(HarHeader header)
+{
+  if (header <= HAR_HEADER_UNKNOWN || header >= HAR_HEADER_LAST) return NULL;
+  return har_header_names[header];
+}
+
+/*
+ * The pool keeps names as they were received (HTTP/1.1 servers
+ * mostly send "Content-Type", HTTP/2 ones "content-type"), since
+ * HAR keeps the case, and stops growing at HAR_HEADER_POOL_MAX
+ * names, after which names are built as before.
+ */
+#define HAR_HEADER_POOL_MAX 4096
+
+typedef struct _HarHeaderPoolEntry {
+  guint32 hash;
+  json_t * json;
+} HarHeaderPoolEntry;
+
+static GMutex har_header_pool_lock;
+static HarHeaderPoolEntry * har_header_pool = NULL;
+static guint har_header_pool_size = 0;
+static guint har_header_pool_used = 0;
+
+static void
+har_header_pool_insert(HarHeaderPoolEntry * pool, guint size, guint32 hash, json_t * json)
+{
+  guint slot = hash & (size - 1);
+
+  while (pool[slot].json) {
+    slot = (slot + 1) & (size - 1);
+  }
+  pool[slot].hash = hash;
+  pool[slot].json = json;
+}
+
+static void
+har_header_pool_grow(void)
+{
+  guint size = har_header_pool_size ? har_header_pool_size * 2 : 64;
+  HarHeaderPoolEntry * pool = g_new0(HarHeaderPoolEntry, size);
+  guint ix;
+
+  for (ix = 0; ix < har_header_pool_size; ix++) {
+    if (har_header_pool[ix].json) {
+      har_header_pool_insert(pool, size, har_header_pool[ix].hash, har_header_pool[ix].json);
+    }
+  }
+  g_free(har_header_pool);
+  har_header_pool = pool;
+  har_header_pool_size = size;
+}
+
+json_t *
+har_header_name_json(const char * name, gsize len)
+{
+  guint32 hash = har_header_hash(name, len, FALSE);
+  json_t * json = NULL;
+  guint slot;
+
+  g_mutex_lock(&har_header_pool_lock);
+  if (har_header_pool_size) {
+    for (slot = hash & (har_header_pool_size - 1);
+         har_header_pool[slot].json;
+         slot = (slot + 1) & (har_header_pool_size - 1)) {
+      if (har_header_pool[slot].hash == hash &&
+          json_string_length(har_header_pool[slot].json) == len &&
+          !memcmp(json_string_value(har_header_pool[slot].json), name, len)) {
+        json = json_incref(har_header_pool[slot].json);
+        break;
+      }
+    }
+  }
+  if (!json && (json = json_stringn(name, len)) && har_header_pool_used < HAR_HEADER_POOL_MAX) {
+    if (2 * (har_header_pool_used + 1) > har_header_pool_size) {
+      har_header_pool_grow();
+    }
+    har_header_pool_insert(har_header_pool, har_header_pool_size, hash, json_incref(json));
+    har_header_pool_used++;
+  }
+  g_mutex_unlock(&har_header_pool_lock);
+  return json;
+}
+
+void
+har_header_pool_clear(void)
+{
+  guint ix;
+
+  g_mutex_lock(&har_header_pool_lock);
+  for (ix = 0; ix < har_header_pool_size; ix++) {
+    json_decref(har_header_pool[ix].json);
+  }
+  g_free(har_header_pool);
+  har_header_pool = NULL;
+  har_header_pool_size = 0;
+  har_header_pool_used = 0;
+  g_mutex_unlock(&har_header_pool_lock);
+}
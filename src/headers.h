@@ -0,0 +1,98 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+#ifndef HARCURL_HEADERS_H
+#define HARCURL_HEADERS_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*
+ * HarHeader:
+ *
+ * The header names of the HPACK static table (RFC 7541,
+ * Appendix A), numbered by the first index they have there.
+ * har_header_lookup() finds them whatever their case, so
+ * that code looking for a header can switch on the number
+ * instead of comparing every name of every entry.
+ */
+typedef enum _HarHeader {
+  HAR_HEADER_UNKNOWN = 0,
+  HAR_HEADER_AUTHORITY = 1,
+  HAR_HEADER_METHOD = 2,
+  HAR_HEADER_PATH = 4,
+  HAR_HEADER_SCHEME = 6,
+  HAR_HEADER_STATUS = 8,
+  HAR_HEADER_ACCEPT_CHARSET = 15,
+  HAR_HEADER_ACCEPT_ENCODING,
+  HAR_HEADER_ACCEPT_LANGUAGE,
+  HAR_HEADER_ACCEPT_RANGES,
+  HAR_HEADER_ACCEPT,
+  HAR_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN,
+  HAR_HEADER_AGE,
+  HAR_HEADER_ALLOW,
+  HAR_HEADER_AUTHORIZATION,
+  HAR_HEADER_CACHE_CONTROL,
+  HAR_HEADER_CONTENT_DISPOSITION,
+  HAR_HEADER_CONTENT_ENCODING,
+  HAR_HEADER_CONTENT_LANGUAGE,
+  HAR_HEADER_CONTENT_LENGTH,
+  HAR_HEADER_CONTENT_LOCATION,
+  HAR_HEADER_CONTENT_RANGE,
+  HAR_HEADER_CONTENT_TYPE,
+  HAR_HEADER_COOKIE,
+  HAR_HEADER_DATE,
+  HAR_HEADER_ETAG,
+  HAR_HEADER_EXPECT,
+  HAR_HEADER_EXPIRES,
+  HAR_HEADER_FROM,
+  HAR_HEADER_HOST,
+  HAR_HEADER_IF_MATCH,
+  HAR_HEADER_IF_MODIFIED_SINCE,
+  HAR_HEADER_IF_NONE_MATCH,
+  HAR_HEADER_IF_RANGE,
+  HAR_HEADER_IF_UNMODIFIED_SINCE,
+  HAR_HEADER_LAST_MODIFIED,
+  HAR_HEADER_LINK,
+  HAR_HEADER_LOCATION,
+  HAR_HEADER_MAX_FORWARDS,
+  HAR_HEADER_PROXY_AUTHENTICATE,
+  HAR_HEADER_PROXY_AUTHORIZATION,
+  HAR_HEADER_RANGE,
+  HAR_HEADER_REFERER,
+  HAR_HEADER_REFRESH,
+  HAR_HEADER_RETRY_AFTER,
+  HAR_HEADER_SERVER,
+  HAR_HEADER_SET_COOKIE,
+  HAR_HEADER_STRICT_TRANSPORT_SECURITY,
+  HAR_HEADER_TRANSFER_ENCODING,
+  HAR_HEADER_USER_AGENT,
+  HAR_HEADER_VARY,
+  HAR_HEADER_VIA,
+  HAR_HEADER_WWW_AUTHENTICATE,
+
+  HAR_HEADER_LAST,
+} HarHeader;
+
+/* case-insensitive, HAR_HEADER_UNKNOWN for names outside the static table */
+HarHeader har_header_lookup(const char * name, gsize len);
+const char * har_header_name(HarHeader header);
+
+/*
+ * The names of the headers that harcurl builds are interned
+ * in a pool for the whole run, so that every "Content-Type"
+ * of every entry is the same (new reference to a) json_t.
+ * The pool is safe to use from the worker threads, and so
+ * are the names, since jansson 2.11 counts references with
+ * atomics (configure asks for it).
+ */
+json_t * har_header_name_json(const char * name, gsize len);
+void har_header_pool_clear(void);
+
+#endif /* HARCURL_HEADERS_H */
@@ -0,0 +1,185 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+/*
+ * The journal of -o FILE, and --resume. See journal.h for
+ * its format.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <jansson.h>
+#include <zlib.h>
+
+#include "config.h"
+#include "harcurl.h"
+#include "journal.h"
+
+static guint32
+har_journal_id(json_t * entry)
+{
+  json_t * req = json_object_get(entry, "request");
+  const char * method = json_string_value(json_object_get(req, "method"));
+  const char * url = json_string_value(json_object_get(req, "url"));
+  guint32 id = (guint32)crc32(0L, Z_NULL, 0);
+
+  if (method) id = (guint32)crc32(id, (const Bytef *)method, strlen(method));
+  id = (guint32)crc32(id, (const Bytef *)" ", 1);
+  if (url) id = (guint32)crc32(id, (const Bytef *)url, strlen(url));
+  return id;
+}
+
+/*
+ * har_journal_read:
+ *
+ * Finds how many entries of the input ("first") are already in
+ * the output, and how long the output ("offset") and the journal
+ * ("length") were after the last of them. A torn last line is
+ * ignored, as are lines that point past the end of the output.
+ */
+int
+har_journal_read(const char * path, const char * output_path, json_t * entries,
+                 int * first, long * offset, long * length, gboolean * done)
+{
+  FILE * stream;
+  char line[256];
+  int count;
+  int version;
+  int index;
+  long at;
+  unsigned int id;
+  struct stat output_stat;
+  long output_size = stat(output_path, &output_stat) == 0 ? (long)output_stat.st_size : 0;
+
+  *first = 0;
+  *offset = 0;
+  *length = 0;
+  *done = FALSE;
+  stream = fopen(path, "rb");
+  if (!stream) {
+    fprintf(stderr, "no journal at %s, starting from the first entry\n", path);
+    return HAR_OK;
+  }
+  if (!fgets(line, sizeof(line), stream) ||
+      sscanf(line, "harcurl-journal %d %d", &version, &count) != 2 ||
+      version != HAR_JOURNAL_VERSION) {
+    fprintf(stderr, "%s is not a harcurl journal\n", path);
+    fclose(stream);
+    return HAR_ERROR_RESUME;
+  }
+  if (count != (int)json_array_size(entries)) {
+    fprintf(stderr, "%s was written for %d entries, but the input has %d\n",
+            path, count, (int)json_array_size(entries));
+    fclose(stream);
+    return HAR_ERROR_RESUME;
+  }
+  *length = ftell(stream);
+
+  while (fgets(line, sizeof(line), stream) && strchr(line, '\n')) {
+    if (sscanf(line, "done %ld", &at) == 1 && *first == count && at <= output_size) {
+      *offset = at;
+      *done = TRUE;
+      break;
+    }
+    if (sscanf(line, "%d %ld %x", &index, &at, &id) != 3 || index != *first || at > output_size) {
+      break;
+    }
+    if (id != har_journal_id(json_array_get(entries, index))) {
+      fprintf(stderr, "entry %d of the input is not the one in %s\n", index, path);
+      fclose(stream);
+      return HAR_ERROR_RESUME;
+    }
+    *first = index + 1;
+    *offset = at;
+    *length = ftell(stream);
+  }
+  fclose(stream);
+  return HAR_OK;
+}
+
+/* keeps the first "length" bytes of the journal, or starts a new one */
+int
+har_journal_open(HarJournal * journal, const char * path, FILE * output,
+                 json_t * entries, int checkpoint, long length)
+{
+  int ix;
+  guint32 id;
+
+  memset(journal, 0, sizeof(*journal));
+  journal->stream = fopen(path, length > 0 ? "r+b" : "wb");
+  if (!journal->stream) {
+    fprintf(stderr, "unable to open %s\n", path);
+    return HAR_ERROR_RESUME;
+  }
+  if (length > 0) {
+    if (ftruncate(fileno(journal->stream), length) != 0) {
+      fprintf(stderr, "unable to truncate %s\n", path);
+      fclose(journal->stream);
+      return HAR_ERROR_RESUME;
+    }
+    fseek(journal->stream, length, SEEK_SET);
+  } else {
+    fprintf(journal->stream, "harcurl-journal %d %d\n", HAR_JOURNAL_VERSION, (int)json_array_size(entries));
+  }
+
+  journal->output = output;
+  journal->checkpoint = MAX(checkpoint, 1);
+  journal->pending = g_string_new(NULL);
+  journal->synced = g_get_monotonic_time();
+  journal->ids = g_array_sized_new(FALSE, FALSE, sizeof(guint32), json_array_size(entries));
+  for (ix = 0; ix < (int)json_array_size(entries); ix++) {
+    id = har_journal_id(json_array_get(entries, ix));
+    g_array_append_val(journal->ids, id);
+  }
+  return HAR_OK;
+}
+
+/* the output first, so that the journal never points past it */
+static void
+har_journal_sync(HarJournal * journal)
+{
+  fflush(journal->output);
+  fsync(fileno(journal->output));
+  fputs(journal->pending->str, journal->stream);
+  fflush(journal->stream);
+  fsync(fileno(journal->stream));
+  g_string_truncate(journal->pending, 0);
+  journal->pending_count = 0;
+  journal->synced = g_get_monotonic_time();
+}
+
+/* called by the writer, once an entry (and all of its hops) is written */
+void
+har_journal_add(HarJournal * journal, int index, long offset)
+{
+  g_string_append_printf(journal->pending, "%d %ld %08x\n", index, offset,
+                         g_array_index(journal->ids, guint32, index));
+  if (++journal->pending_count >= journal->checkpoint ||
+      g_get_monotonic_time() - journal->synced >= G_USEC_PER_SEC) {
+    har_journal_sync(journal);
+  }
+}
+
+/* with an offset, the log is complete, and --resume has nothing left to do */
+void
+har_journal_close(HarJournal * journal, long offset)
+{
+  if (offset >= 0) {
+    g_string_append_printf(journal->pending, "done %ld\n", offset);
+  }
+  har_journal_sync(journal);
+  fclose(journal->stream);
+  g_string_free(journal->pending, TRUE);
+  g_array_free(journal->ids, TRUE);
+  memset(journal, 0, sizeof(*journal));
+}
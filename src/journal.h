@@ -0,0 +1,56 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+#ifndef HARCURL_JOURNAL_H
+#define HARCURL_JOURNAL_H
+
+#include <stdio.h>
+#include <glib.h>
+#include <jansson.h>
+
+/*
+ * HarJournal:
+ *
+ * The sidecar of -o FILE (FILE.journal), from which --resume
+ * picks up a batch run where it died. It is a text file:
+ *
+ *   harcurl-journal 1 COUNT
+ *   INDEX OFFSET ID           for every entry, in order
+ *   done OFFSET               once the log is complete
+ *
+ * where OFFSET is the size of FILE once the entry was written,
+ * and ID is the CRC-32 of the method and URL of the entry, so
+ * that --resume notices when the input is another one. Since
+ * the writer writes entries in order, the journal always has
+ * the first entries. FILE is synced before the journal, every
+ * --checkpoint entries (or every second), so the journal never
+ * points past what is on disk, and a crash loses at most the
+ * entries since the last sync, which --resume sends again.
+ */
+#define HAR_JOURNAL_VERSION 1
+
+
+typedef struct _HarJournal {
+  FILE * stream;
+  FILE * output;
+  GArray * ids;
+  int checkpoint;
+  int pending_count;
+  GString * pending;
+  gint64 synced;
+} HarJournal;
+
+int har_journal_read(const char * path, const char * output_path, json_t * entries,
+                     int * first, long * offset, long * length, gboolean * done);
+int har_journal_open(HarJournal * journal, const char * path, FILE * output,
+                     json_t * entries, int checkpoint, long length);
+void har_journal_add(HarJournal * journal, int index, long offset);
+void har_journal_close(HarJournal * journal, long offset);
+
+#endif /* HARCURL_JOURNAL_H */
@@ -8,46 +8,47 @@
  */
 
 #include <assert.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
 #include <curl/curl.h>
 #include <glib.h>
 #include <jansson.h>
 #include <zlib.h>
 
 #include "config.h"
+#include "harcurl.h"
+#include "capture.h"
+#include "compare.h"
+#include "headers.h"
+#include "journal.h"
+#include "scheduler.h"
+#include "simd.h"
+
+#ifdef HAVE_OPENSSL
+#include <openssl/ssl.h>
+#endif
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define HAR_PROBE(probe, phase, index) DTRACE_PROBE2(harcurl, probe, har_phase_names[phase], index)
+#else
+#define HAR_PROBE(probe, phase, index)
+#endif
 
 gboolean global_verbose = FALSE;
-
-/*
- * HarStatusCode:
- * 
- * This enumeration is designed to work with
- * libcurl status codes. The maximum status code
- * that libcurl uses at the time of this writing
- * is 89, so 128 should be enough for future
- * expansions, if libcurl wants to do so.
- */
-typedef enum _HarStatusCode {
-  HAR_OK = CURLE_OK,
-  
-  HAR_ERROR_UNKNOWN = 0x80,   /* 128 */
-  HAR_ERROR_NO_REQUEST,       /* 129 */
-  HAR_ERROR_NO_RESPONSE,      /* 130 */
-  HAR_ERROR_NO_METHOD,        /* 131 */
-  HAR_ERROR_NO_URL,           /* 132 */
-  HAR_ERROR_TEXT_AND_PARAMS,  /* 133 */
-  HAR_ERROR_WITH_CURL,        /* 134 = libcurl returned an error */
-  HAR_ERROR_WITH_HTTP,        /* 135 = HTTP protocol violation */
-  HAR_ERROR_WITH_JANSSON,     /* 136 = libjansson returned an error */
-  HAR_ERROR_WITH_JSON,        /* 137 = JSON was unparsable */
-  
-  HAR_ERROR_LAST,             /* 138 */
-} HarStatusCode;
+gboolean global_profile = FALSE;
+gboolean global_events = FALSE;
+gboolean global_capture = FALSE;
+gchar * global_tls_session_cache = NULL;
 
 int
 har_curl_formadd_strerror(int errnum, char * strerrbuf, size_t buflen)
@@ -116,59 +117,70 @@ struct curl_slist *
 har_headers_to_curl_slist(json_t * headers)
 {
   struct curl_slist * result = NULL;
-  json_t * vj;
   json_t * pj;
   const char * ks;
   const char * vs;
   int ix;
+  GString * line = g_string_sized_new(256);
   
+  /* curl_slist_append copies the line, so one buffer does for all of them */
   json_array_foreach(headers, ix, pj) {
     ks = json_string_value(json_object_get(pj, "name"));
     vs = json_string_value(json_object_get(pj, "value"));
-    size_t s_len = strlen(ks) + strlen(vs) + 5;
-    char * s = g_malloc0(s_len);
-    snprintf(s, s_len, "%s: %s", ks, vs);
-    result = curl_slist_append(result, s);
+    g_string_truncate(line, 0);
+    g_string_append(line, ks);
+    g_string_append(line, ": ");
+    g_string_append(line, vs);
+    result = curl_slist_append(result, line->str);
   }
+  g_string_free(line, TRUE);
   
   return result;
 }
 
+/*
+ * har_headers_from_text:
+ *
+ * Parses the "Name: value" lines of a header block in place,
+ * with the names taken from the pool of headers.h, so that
+ * nothing is allocated but the JSON values themselves.
+ */
 void
 har_headers_from_text(json_t * headers, const char * s, size_t s_len)
 {
-  int ix;
-  gchar ** parts;
-  gchar * line;
-  gchar ** lines;
-  json_t * header;
-  const char * name;
+  const char * end;
+  const char * line;
+  const char * eol;
+  const char * colon;
   const char * value;
+  json_t * header;
   if (!s) {
     fprintf(stderr, "har_headers_from_text(NULL)\n");
     return;
   }
 
-  lines = g_strsplit(s, "\r\n", 100);
-  for (ix = 0; lines[ix]; ++ix) {
-    line = lines[ix];
-    if (!line) break;
-    if (strlen(line) == 0) continue;
+  end = s + strnlen(s, s_len);
+  for (line = s; line < end; line = eol + 2) {
+    for (eol = line; (eol = memchr(eol, '\r', end - eol)) && (eol + 1 >= end || eol[1] != '\n'); eol++);
+    if (!eol) {
+      eol = end;
+    }
 
-    parts = g_strsplit(line, ":", 2);
-    if (!parts) continue;
-    if (!parts[1]) continue;
-    header = json_object();
-    name = parts[0];
-    value = parts[1];
+    /* the status line, and the empty line at the end, have no colon */
+    colon = memchr(line, ':', eol - line);
+    if (colon) {
+      value = colon + 1;
 
-    /* to account for the space */
-    if (value[0] == ' ') 
-      value++;
+      /* to account for the space */
+      if (value < eol && value[0] == ' ')
+        value++;
 
-    json_object_set_new(header, "name", json_string(name));
-    json_object_set_new(header, "value", json_string(value));
-    json_array_append_new(headers, header);
+      header = json_object();
+      json_object_set_new(header, "name", har_header_name_json(line, colon - line));
+      json_object_set_new(header, "value", json_stringn(value, eol - value));
+      json_array_append_new(headers, header);
+    }
+    if (eol >= end) break;
   }
 }
 
@@ -194,6 +206,15 @@ int har_strerror(int status, char *strerrbuf, size_t buflen)
   case HAR_ERROR_TEXT_AND_PARAMS:
     strncpy(strerrbuf, "Both text and params were given in the request.postData property. Please use one or the other, but not both.", buflen);
     break;
+  case HAR_ERROR_NETWORK_PROFILE:
+    strncpy(strerrbuf, "The network profile is invalid. Please use a preset, key=value pairs, or both, separated by commas.", buflen);
+    break;
+  case HAR_ERROR_CAPTURE:
+    strncpy(strerrbuf, "The capture file could not be opened, written, or read.", buflen);
+    break;
+  case HAR_ERROR_RESUME:
+    strncpy(strerrbuf, "The journal of the output could not be read or written, or was written for another input.", buflen);
+    break;
   default:
     {
       err = curl_easy_strerror(status);
@@ -216,17 +237,22 @@ har_request_to_curl_slist(json_t * req)
   json_t * header;
   json_t * headers = json_object_get(req, "headers");
   
+  /* only --verbose needs to look at the names */
+  if (!global_verbose) {
+    return har_headers_to_curl_slist(headers);
+  }
   json_array_foreach(headers, ix, header) {
-    const char * name = json_string_value(json_object_get(header, "name"));
+    json_t * name = json_object_get(header, "name");
     
-    if (global_verbose && !g_ascii_strcasecmp(name, "content-encoding")) {
-      const char * value = json_string_value(json_object_get(header, "value"));
-      json_object_set_new(req, "_contentEncoding", json_string(value));
-    }
-
-    if (global_verbose && !g_ascii_strcasecmp(name, "content-type")) {
-      const char * value = json_string_value(json_object_get(header, "value"));
-      json_object_set_new(req, "_contentType", json_string(value));
+    switch (har_header_lookup(json_string_value(name), json_string_length(name))) {
+    case HAR_HEADER_CONTENT_ENCODING:
+      json_object_set(req, "_contentEncoding", json_object_get(header, "value"));
+      break;
+    case HAR_HEADER_CONTENT_TYPE:
+      json_object_set(req, "_contentType", json_object_get(header, "value"));
+      break;
+    default:
+      break;
     }
   }
   
@@ -253,8 +279,8 @@ har_request_postdata_to_curl_httppost(json_t * req)
   if (!postdata || !json_is_object(postdata)) return NULL;
   part = json_object_get(postdata, "mimeType");
   if (part && json_is_string(part)) {
-    fprintf(stderr, "request.postData.mimeType\n");
-    json_object_set_new(req, "_contentType", part);
+    if (global_verbose) fprintf(stderr, "request.postData.mimeType\n");
+    json_object_set(req, "_contentType", part);
   }
 
   params = json_object_get(postdata, "params");
@@ -354,12 +380,13 @@ har_request_postdata_to_byte_array(json_t * req, GByteArray * bytes)
     type = json_string_value(type_part);
     text = json_string_value(text_part);
     if (enc_part && json_is_string(enc_part) &&
-        g_ascii_strcasecmp(json_string_value(enc_part), "base64")) {
-      fprintf(stderr, "request.postData.text (base64)\n");
-      text = (const char *)g_base64_decode(text, &size);
+        !g_ascii_strcasecmp(json_string_value(enc_part), "base64")) {
+      if (global_verbose) fprintf(stderr, "request.postData.text (base64)\n");
+      text = (const char *)har_base64_decode(text, &size);
       g_byte_array_append(bytes, (const guint8 *)text, size);
+      g_free((gpointer)text);
     } else {
-      fprintf(stderr, "request.postData.text (plain)\n");
+      if (global_verbose) fprintf(stderr, "request.postData.text (plain)\n");
       size = strlen(json_string_value(text_part));
       text = json_string_value(text_part);
       g_byte_array_append(bytes, (const guint8 *)text, size);
@@ -389,17 +416,22 @@ har_response_headers_from_byte_array(json_t * resp, GByteArray * bytes)
 
   har_headers_from_text(headers, s, s_len);
 
+  /* only --verbose needs to look at the names */
+  if (!global_verbose) {
+    return;
+  }
   json_array_foreach(headers, ix, header) {
-    const char * name = json_string_value(json_object_get(header, "name"));
+    json_t * name = json_object_get(header, "name");
     
-    if (global_verbose && !g_ascii_strcasecmp(name, "content-encoding")) {
-      const char * value = json_string_value(json_object_get(header, "value"));
-      json_object_set_new(resp, "_contentEncoding", json_string(value));
-    }
-
-    if (global_verbose && !g_ascii_strcasecmp(name, "content-type")) {
-      const char * value = json_string_value(json_object_get(header, "value"));
-      json_object_set_new(resp, "_contentType", json_string(value));
+    switch (har_header_lookup(json_string_value(name), json_string_length(name))) {
+    case HAR_HEADER_CONTENT_ENCODING:
+      json_object_set(resp, "_contentEncoding", json_object_get(header, "value"));
+      break;
+    case HAR_HEADER_CONTENT_TYPE:
+      json_object_set(resp, "_contentType", json_object_get(header, "value"));
+      break;
+    default:
+      break;
     }
   }
   
@@ -444,20 +476,27 @@ har_window_bits(const char * content_encoding)
   return 0;
 }
 
+/*
+ * har_uncompress:
+ *
+ * Inflates src_data onto the end of dest, growing it as
+ * needed, since the size of a body is only known once it
+ * has been inflated (and can be far more than twice the
+ * compressed size).
+ */
 int
-har_uncompress(gpointer dest_data, gsize * dest_len,
+har_uncompress(GByteArray * dest,
                gconstpointer src_data, gsize src_len,
                int windowBits)
 {
 
   int ret;
+  guint start = dest->len;
   z_stream stream;
   memset(&stream, 0, sizeof(stream));
 
   stream.next_in = (Bytef *)src_data;
   stream.avail_in = src_len;
-  stream.next_out = (Bytef *)dest_data;
-  stream.avail_out = *dest_len;
   if (src_len == 0) {
     return Z_DATA_ERROR;
   }
@@ -467,16 +506,18 @@ har_uncompress(gpointer dest_data, gsize * dest_len,
     return ret;
   }
 
-  ret = inflate(&stream, Z_NO_FLUSH);
-  (void)inflateEnd(&stream);
-  if (ret != Z_STREAM_END) {
-    return ret;
-  }
+  do {
+    guint chunk = MAX(src_len * 2, 16384);
+    g_byte_array_set_size(dest, start + stream.total_out + chunk);
+    stream.next_out = (Bytef *)(dest->data + start + stream.total_out);
+    stream.avail_out = chunk;
+    ret = inflate(&stream, Z_NO_FLUSH);
+  } while (ret == Z_OK && stream.avail_out == 0);
 
-  *dest_len = stream.total_out;
-  fprintf(stderr, "avail_out: %d (should be zero)\n", stream.avail_out);
+  g_byte_array_set_size(dest, start + stream.total_out);
+  (void)inflateEnd(&stream);
   
-  return ret == Z_STREAM_END ? Z_OK : ret;
+  return ret == Z_STREAM_END ? Z_OK : (ret == Z_OK ? Z_BUF_ERROR : ret);
 }
 
 GBytes *
@@ -484,24 +525,30 @@ har_bytes_uncompress(const GBytes * src, int windowBits)
 {
   gsize src_len;
   gconstpointer src_data = g_bytes_get_data((GBytes *)src, &src_len);
-  gsize dest_len = ((size_t)(((float)(src_len)) * 2.0f)) + 24;
-  gpointer dest_data = g_malloc(dest_len);
+  GByteArray * dest = g_byte_array_sized_new(src_len * 4 + 24);
   int status;
   
-  if ((status = har_uncompress(dest_data, &dest_len, src_data, src_len, windowBits)) != Z_OK) {
+  if ((status = har_uncompress(dest, src_data, src_len, windowBits)) != Z_OK) {
     char buf[1024];
     har_zlib_strerror(status, buf, sizeof(buf));
     fprintf(stderr, "there was an error with zlib: %d %s\n", status, buf);
+    g_byte_array_free(dest, TRUE);
     return (GBytes *)src;
   }
   
-  return g_bytes_new(dest_data, dest_len);
+  return g_byte_array_free_to_bytes(dest);
 }
 
 GByteArray *
 har_byte_array_uncompress(GByteArray * src, int windowBits)
 {
-  return g_bytes_unref_to_array(har_bytes_uncompress(g_byte_array_free_to_bytes(src), windowBits));
+  GBytes * src_bytes = g_byte_array_free_to_bytes(src);
+  GBytes * dest_bytes = har_bytes_uncompress(src_bytes, windowBits);
+
+  if (dest_bytes != src_bytes) {
+    g_bytes_unref(src_bytes);
+  }
+  return g_bytes_unref_to_array(dest_bytes);
 }
 
 //const char *
@@ -518,22 +565,243 @@ har_response_content_from_byte_array(json_t * resp, GByteArray * bytes)
   //fprintf(stderr, "har_response_content_from_byte_array\n");
   guint size = bytes->len;
   const char * text = (const char *)(bytes->data);
-  const char * end = NULL;
   json_t * part;
   json_t * content = json_object_get(resp, "content");
   const char * encoding = NULL;
 
-  if (g_utf8_validate(text, size, &end)) {
-    json_object_set_new(content, "text", json_string(text));
+  /* the body is not NUL-terminated, hence json_stringn */
+  if (har_utf8_validate(text, size)) {
+    json_object_set_new(content, "text", json_stringn(text, size));
   } else {
-    text = g_base64_encode((const guchar *)text, size);
+    text = har_base64_encode((const guchar *)text, size);
     json_object_set_new(content, "text", json_string(text));
     json_object_set_new(content, "encoding", json_string("base64"));
+    g_free((gpointer)text);
   }
 
   return;
 }
 
+#ifdef HAVE_OPENSSL
+/*
+ * TLS session cache:
+ *
+ * libcurl keeps TLS sessions for as long as the share
+ * lives, which is one harcurl invocation. To resume them
+ * in the next invocation, we keep our own copy of every
+ * session and write them to a file at exit, one
+ * "host:port base64(DER)" per line. The host and port are
+ * those of the URL of the transfer, which libcurl makes a
+ * new SSL_CTX for, and which we keep in its ex data, since
+ * the SNI host name says nothing of the port, and is not
+ * sent at all to IP addresses.
+ */
+GHashTable * global_tls_sessions = NULL;
+GMutex global_tls_sessions_lock;
+int (*global_tls_new_session_callback)(SSL *, SSL_SESSION *) = NULL;
+int global_tls_key_index = -1;
+
+void
+har_tls_key_free(void * parent, void * key, CRYPTO_EX_DATA * data, int index, long argl, void * argp)
+{
+  g_free(key);
+}
+
+/* "host:port" of the URL the transfer is connecting to, or NULL */
+gchar *
+har_tls_session_key(CURL * easy)
+{
+  const char * url = NULL;
+  CURLU * h;
+  char * host_part = NULL;
+  char * port_part = NULL;
+  gchar * key = NULL;
+
+  if (curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK || !url) return NULL;
+
+  h = curl_url();
+  if (curl_url_set(h, CURLUPART_URL, url, 0) == CURLUE_OK &&
+      curl_url_get(h, CURLUPART_HOST, &host_part, 0) == CURLUE_OK &&
+      curl_url_get(h, CURLUPART_PORT, &port_part, CURLU_DEFAULT_PORT) == CURLUE_OK) {
+    key = g_strdup_printf("%s:%s", host_part, port_part);
+  }
+
+  curl_free(host_part);
+  curl_free(port_part);
+  curl_url_cleanup(h);
+  return key;
+}
+
+/* the key har_ssl_ctx_callback kept for the connection of ssl */
+const char *
+har_tls_session_key_of(const SSL * ssl)
+{
+  return (const char *)SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), global_tls_key_index);
+}
+
+int
+har_tls_session_cache_load(const char * path)
+{
+  int ix;
+  gchar * contents = NULL;
+  gchar ** lines;
+  long now = (long)time(NULL);
+
+  global_tls_sessions = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                              g_free, (GDestroyNotify)SSL_SESSION_free);
+  global_tls_key_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, &har_tls_key_free);
+
+  /* a missing file is an empty cache */
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+    return HAR_OK;
+  }
+
+  lines = g_strsplit(contents, "\n", -1);
+  for (ix = 0; lines[ix]; ++ix) {
+    gchar ** parts = g_strsplit(g_strstrip(lines[ix]), " ", 2);
+    if (parts[0] && parts[1]) {
+      gsize der_len = 0;
+      guchar * der = g_base64_decode(parts[1], &der_len);
+      const unsigned char * p = der;
+      SSL_SESSION * session = d2i_SSL_SESSION(NULL, &p, (long)der_len);
+      if (session && SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) > now) {
+        g_hash_table_replace(global_tls_sessions, g_strdup(parts[0]), session);
+      } else if (session) {
+        SSL_SESSION_free(session);
+      }
+      g_free(der);
+    }
+    g_strfreev(parts);
+  }
+
+  g_strfreev(lines);
+  g_free(contents);
+  return HAR_OK;
+}
+
+int
+har_tls_session_cache_save(const char * path)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  GError * error = NULL;
+  GString * contents = g_string_new(NULL);
+
+  g_mutex_lock(&global_tls_sessions_lock);
+  g_hash_table_iter_init(&iter, global_tls_sessions);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    unsigned char * der = NULL;
+    int der_len = i2d_SSL_SESSION((SSL_SESSION *)value, &der);
+    if (der_len > 0) {
+      gchar * text = g_base64_encode(der, der_len);
+      g_string_append_printf(contents, "%s %s\n", (const char *)key, text);
+      g_free(text);
+    }
+    OPENSSL_free(der);
+  }
+  g_mutex_unlock(&global_tls_sessions_lock);
+
+  if (!g_file_set_contents(path, contents->str, contents->len, &error)) {
+    fprintf(stderr, "unable to write %s: %s\n", path, error->message);
+    g_error_free(error);
+    g_string_free(contents, TRUE);
+    return HAR_ERROR_UNKNOWN;
+  }
+
+  g_string_free(contents, TRUE);
+  return HAR_OK;
+}
+
+/* called by OpenSSL whenever the server gives us a session (or a ticket) */
+int
+har_tls_new_session_callback(SSL * ssl, SSL_SESSION * session)
+{
+  const char * key = har_tls_session_key_of(ssl);
+  int ret = 0;
+
+  /* libcurl installed its own callback first, and still needs it */
+  if (global_tls_new_session_callback) {
+    ret = global_tls_new_session_callback(ssl, session);
+  }
+
+  if (key && SSL_SESSION_is_resumable(session)) {
+    SSL_SESSION_up_ref(session);
+    g_mutex_lock(&global_tls_sessions_lock);
+    g_hash_table_replace(global_tls_sessions, g_strdup(key), session);
+    g_mutex_unlock(&global_tls_sessions_lock);
+  }
+
+  return ret;
+}
+
+/* called by OpenSSL before the ClientHello, which is our chance to offer a session */
+void
+har_tls_info_callback(const SSL * cssl, int where, int ret)
+{
+  SSL * ssl = (SSL *)cssl;
+  const char * key;
+  SSL_SESSION * session;
+
+  if (!(where & SSL_CB_HANDSHAKE_START) || SSL_is_server(ssl)) return;
+
+  /* libcurl already offers a session from this run */
+  if (SSL_get0_session(ssl)) return;
+
+  key = har_tls_session_key_of(ssl);
+  if (!key) return;
+
+  g_mutex_lock(&global_tls_sessions_lock);
+  session = g_hash_table_lookup(global_tls_sessions, key);
+  if (session) {
+    SSL_set_session(ssl, session);
+  }
+  g_mutex_unlock(&global_tls_sessions_lock);
+}
+
+CURLcode
+har_ssl_ctx_callback(CURL * easy, void * sslctx, void * parm)
+{
+  SSL_CTX * ctx = (SSL_CTX *)sslctx;
+  int (*callback)(SSL *, SSL_SESSION *) = SSL_CTX_sess_get_new_cb(ctx);
+
+  if (callback != &har_tls_new_session_callback) {
+    global_tls_new_session_callback = callback;
+  }
+
+  /* libcurl makes an SSL_CTX for every connection, but should it reuse one, the key changes */
+  g_free(SSL_CTX_get_ex_data(ctx, global_tls_key_index));
+  SSL_CTX_set_ex_data(ctx, global_tls_key_index, har_tls_session_key(easy));
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL);
+  SSL_CTX_sess_set_new_cb(ctx, &har_tls_new_session_callback);
+  SSL_CTX_set_info_callback(ctx, &har_tls_info_callback);
+  return CURLE_OK;
+}
+#endif
+
+void
+har_entry_tls_from_curl_easy_getinfo(json_t * entry, CURL * easy)
+{
+  struct curl_tlssessioninfo * info = NULL;
+
+  if (json_object_get(entry, "_tlsVersion")) return;
+  if (curl_easy_getinfo(easy, CURLINFO_TLS_SSL_PTR, &info) != CURLE_OK) return;
+  if (!info || info->backend == CURLSSLBACKEND_NONE || !info->internals) return;
+
+#ifdef HAVE_OPENSSL
+  /* the SSL pointer is only valid while the connection is live,
+   * which is why we are called from the debug callback and not
+   * from har_entry_from_curl_easy_getinfo.
+   */
+  if (info->backend == CURLSSLBACKEND_OPENSSL) {
+    SSL * ssl = (SSL *)info->internals;
+    json_object_set_new(entry, "_tlsVersion", json_string(SSL_get_version(ssl)));
+    json_object_set_new(entry, "_tlsCipher", json_string(SSL_get_cipher_name(ssl)));
+    json_object_set_new(entry, "_tlsSessionResumed", json_boolean(SSL_session_reused(ssl)));
+  }
+#endif
+}
+
 int
 har_debug_callback(CURL * easy,
                    curl_infotype type,
@@ -573,6 +841,9 @@ har_debug_callback(CURL * easy,
     json_t * headers = json_object_get(req, "headers");
 
     json_object_set_new(req, "headersSize", json_integer(size));
+    if (global_verbose || global_tls_session_cache) {
+      har_entry_tls_from_curl_easy_getinfo(entry, easy);
+    }
     if (global_verbose) {
       har_headers_from_text(headers, s, size);
       
@@ -807,8 +1078,6 @@ har_entry_to_curl_easy_setopt(json_t * obj, CURL * easy,
   json_t * part;
   struct curl_httppost * formpost;
   
-  json_incref(entry);
-  
   if (!req) {
     return HAR_ERROR_NO_REQUEST;
   }
@@ -855,10 +1124,10 @@ har_entry_to_curl_easy_setopt(json_t * obj, CURL * easy,
     fprintf(stderr, "both params and text\n");
     return status;
   } else if (formpost) {
-    fprintf(stderr, "request.postData.params\n");
+    if (global_verbose) fprintf(stderr, "request.postData.params\n");
     curl_easy_setopt(easy, CURLOPT_HTTPPOST, formpost);
   } else if (harbodyin->len) {
-    fprintf(stderr, "request.postData.text\n");
+    if (global_verbose) fprintf(stderr, "request.postData.text\n");
     //curl_easy_setopt(easy, CURLOPT_READDATA, harbodyin);
     //curl_easy_setopt(easy, CURLOPT_READFUNCTION, &har_read_callback);
     curl_easy_setopt(easy, CURLOPT_POSTFIELDS, harbodyin->data);
@@ -880,28 +1149,222 @@ har_entry_to_curl_easy_setopt(json_t * obj, CURL * easy,
   return HAR_OK;
 }
 
+double
+har_timing_ms(curl_off_t from, curl_off_t to)
+{
+  if (to <= 0 || to < from) return -1;
+  return (1.0e-3)*(double)(to - from);
+}
+
+void
+har_entry_timings_from_curl_easy_getinfo(json_t * entry, CURL * easy)
+{
+  long connects = 0;
+  curl_off_t namelookup = 0;
+  curl_off_t connect = 0;
+  curl_off_t appconnect = 0;
+  curl_off_t pretransfer = 0;
+  curl_off_t starttransfer = 0;
+  curl_off_t total = 0;
+  json_t * timings = json_object();
+
+  curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
+  curl_easy_getinfo(easy, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+  curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME_T, &connect);
+  curl_easy_getinfo(easy, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+  curl_easy_getinfo(easy, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+  curl_easy_getinfo(easy, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+  curl_easy_getinfo(easy, CURLINFO_TOTAL_TIME_T, &total);
+
+  /* HAR says dns/connect/ssl are -1 when they do not apply,
+   * which is the case for a connection taken from the pool.
+   * Also, in HAR "connect" includes "ssl", just like libcurl.
+   */
+  json_object_set_new(timings, "blocked", json_real(-1));
+  if (connects > 0) {
+    json_object_set_new(timings, "dns", json_real(har_timing_ms(0, namelookup)));
+    json_object_set_new(timings, "connect", json_real(har_timing_ms(namelookup, appconnect ? appconnect : connect)));
+    json_object_set_new(timings, "ssl", json_real(har_timing_ms(connect, appconnect)));
+  } else {
+    json_object_set_new(timings, "dns", json_real(-1));
+    json_object_set_new(timings, "connect", json_real(-1));
+    json_object_set_new(timings, "ssl", json_real(-1));
+  }
+  json_object_set_new(timings, "send", json_real(har_timing_ms(MAX(connect, appconnect), pretransfer)));
+  json_object_set_new(timings, "wait", json_real(har_timing_ms(pretransfer, starttransfer)));
+  json_object_set_new(timings, "receive", json_real(har_timing_ms(starttransfer, total)));
+  json_object_set_new(entry, "timings", timings);
+}
+
+void
+har_entry_connection_from_curl_easy_getinfo(json_t * entry, CURL * easy)
+{
+  long connects = 0;
+  long local_port = 0;
+  long remote_port = 0;
+  const char * remote_ip = NULL;
+  const char * local_ip = NULL;
+  char connection[32];
+  gboolean connected;
+
+  curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
+  curl_easy_getinfo(easy, CURLINFO_PRIMARY_IP, &remote_ip);
+  curl_easy_getinfo(easy, CURLINFO_PRIMARY_PORT, &remote_port);
+  curl_easy_getinfo(easy, CURLINFO_LOCAL_IP, &local_ip);
+  curl_easy_getinfo(easy, CURLINFO_LOCAL_PORT, &local_port);
+
+  if (remote_ip && *remote_ip) {
+    json_object_set_new(entry, "serverIPAddress", json_string(remote_ip));
+  }
+
+  /* HAR allows "the client or server port number" as
+   * the connection ID, but libcurl has a real one now.
+   */
+#if LIBCURL_VERSION_NUM >= 0x080200
+  curl_off_t conn_id = -1;
+  curl_easy_getinfo(easy, CURLINFO_CONN_ID, &conn_id);
+  connected = conn_id >= 0;
+  if (connected) {
+    snprintf(connection, sizeof(connection), "%" CURL_FORMAT_CURL_OFF_T, conn_id);
+    json_object_set_new(entry, "connection", json_string(connection));
+  }
+#else
+  connected = remote_ip && *remote_ip && local_port > 0;
+  if (local_port > 0) {
+    snprintf(connection, sizeof(connection), "%ld", local_port);
+    json_object_set_new(entry, "connection", json_string(connection));
+  }
+#endif
+
+  if (global_verbose) {
+    /* a transfer that never got a connection (DNS or connect failed) did not reuse one either */
+    if (connected) {
+      json_object_set_new(entry, "_connectionReused", json_boolean(connects == 0));
+    }
+    json_object_set_new(entry, "_numConnects", json_integer(connects));
+    if (local_ip && *local_ip) {
+      json_object_set_new(entry, "_localIPAddress", json_string(local_ip));
+    }
+    json_object_set_new(entry, "_localPort", json_integer(local_port));
+    json_object_set_new(entry, "_remotePort", json_integer(remote_port));
+  }
+}
+
+/*
+ * har_phase_begin/end:
+ *
+ * Bracket one phase of one entry (index is -1 for the
+ * whole run). Without --profile, this is only a branch,
+ * and the probes are a nop until a tracer attaches.
+ */
+const char * har_phase_names[] = {
+  "load", "setopt", "perform", "getinfo", "headers", "decompress", "content", "dump"
+};
+
+gint64
+har_thread_cpu_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+void
+har_phase_begin(HarPhaseClock * clock, HarPhase phase, int index)
+{
+  HAR_PROBE(phase__start, phase, index);
+  if (global_profile) {
+    clock->wall = g_get_monotonic_time();
+    clock->cpu = har_thread_cpu_time();
+  }
+}
+
+void
+har_phase_end(HarProfile * profile, HarPhaseClock * clock, HarPhase phase, int index)
+{
+  HAR_PROBE(phase__done, phase, index);
+  if (global_profile && profile) {
+    profile->wall[phase] += g_get_monotonic_time() - clock->wall;
+    profile->cpu[phase] += har_thread_cpu_time() - clock->cpu;
+    profile->count[phase]++;
+  }
+}
+
+void
+har_profile_add(HarProfile * dest, const HarProfile * src)
+{
+  int ix;
+  for (ix = 0; ix < HAR_PHASE_LAST; ix++) {
+    dest->wall[ix] += src->wall[ix];
+    dest->cpu[ix] += src->cpu[ix];
+    dest->count[ix] += src->count[ix];
+  }
+}
+
+json_t *
+har_profile_to_json(const HarProfile * profile, gboolean counts)
+{
+  int ix;
+  json_t * timings = json_object();
+
+  for (ix = 0; ix < HAR_PHASE_LAST; ix++) {
+    json_t * phase;
+    if (!profile->count[ix]) continue;
+    phase = json_object();
+    json_object_set_new(phase, "wall", json_real((1.0e-3)*(double)profile->wall[ix]));
+    json_object_set_new(phase, "cpu", json_real((1.0e-3)*(double)profile->cpu[ix]));
+    if (counts) {
+      json_object_set_new(phase, "count", json_integer(profile->count[ix]));
+    }
+    json_object_set_new(timings, har_phase_names[ix], phase);
+  }
+
+  return timings;
+}
+
 int
-har_entry_from_curl_easy_getinfo(json_t * obj, CURL * easy,
-                                 GByteArray * harheadout,
-                                 GByteArray * harbodyout)
+har_entry_from_curl_easy_getinfo(json_t * obj, CURL * easy)
 {
   json_t * entry = obj;
-  json_t * req = json_object_get(entry, "request");
   json_t * resp = json_object_get(entry, "response");
-  json_t * part;
 
   long status;
   curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
   json_object_set_new(resp, "status", json_integer(status));
 
-  const char * redirect_url;
-  curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &redirect_url);
-  if (redirect_url) {
-    json_object_set_new(resp, "redirectURL", json_string(g_strdup(redirect_url)));
-  }
+  /* the Location of this response, made absolute, or "" */
+  const char * redirect_url = NULL;
+  curl_easy_getinfo(easy, CURLINFO_REDIRECT_URL, &redirect_url);
+  json_object_set_new(resp, "redirectURL", json_string(redirect_url ? redirect_url : ""));
+
+  har_entry_connection_from_curl_easy_getinfo(entry, easy);
+  har_entry_timings_from_curl_easy_getinfo(entry, easy);
+
+  return HAR_OK;
+}
+
+/*
+ * har_entry_from_byte_arrays:
+ *
+ * The part of filling in the response that does not need the
+ * curl_easy handle, and so can be done on another thread.
+ * Note that *harbodyout is replaced when it was compressed.
+ */
+int
+har_entry_from_byte_arrays(json_t * obj,
+                           GByteArray * harheadout,
+                           GByteArray ** harbodyout,
+                           HarProfile * profile, int index)
+{
+  json_t * entry = obj;
+  json_t * resp = json_object_get(entry, "response");
+  json_t * part;
+  HarPhaseClock clock;
 
   /* finish up with write callback */
+  har_phase_begin(&clock, HAR_PHASE_HEADERS, index);
   har_response_headers_from_byte_array(resp, harheadout);
+  har_phase_end(profile, &clock, HAR_PHASE_HEADERS, index);
 
   // TODO: GET content-encoding header
   //const char * content_encoding = "identity";
@@ -913,127 +1376,2569 @@ har_entry_from_curl_easy_getinfo(json_t * obj, CURL * easy,
     if (windowBits == -1) {
       fprintf(stderr, "unrecognized Content-Encoding\n");
     } else if (windowBits != 0) {
-      harbodyout = har_byte_array_uncompress(harbodyout, windowBits);
+      har_phase_begin(&clock, HAR_PHASE_DECOMPRESS, index);
+      *harbodyout = har_byte_array_uncompress(*harbodyout, windowBits);
+      har_phase_end(profile, &clock, HAR_PHASE_DECOMPRESS, index);
     }
   }
   
-  har_response_content_from_byte_array(resp, harbodyout);
+  /* with --capture, the body is kept as it is, and harcurl convert makes the text */
+  if (!global_capture) {
+    har_phase_begin(&clock, HAR_PHASE_CONTENT, index);
+    har_response_content_from_byte_array(resp, *harbodyout);
+    har_phase_end(profile, &clock, HAR_PHASE_CONTENT, index);
+  }
 
   return HAR_OK;
 }
 
+/*
+ * HarNetwork:
+ *
+ * An emulated network profile, applied to one transfer
+ * without root, tc or netem: bandwidth caps through libcurl
+ * (CURLOPT_MAX_RECV_SPEED_LARGE and CURLOPT_MAX_SEND_SPEED_LARGE),
+ * a small receive buffer (CURLOPT_BUFFERSIZE and SO_RCVBUF),
+ * and latency, which is added by pausing the transfer when
+ * the first byte of the response comes in, for "latency"
+ * milliseconds, plus "connectLatency" when the transfer had
+ * to open a new connection. Zero means no limit.
+ *
+ * libcurl only checks its receive limit after reading up to
+ * a hundred buffers, so a body smaller than that would not
+ * be slowed down at all: har_network_write_callback also
+ * paces the body by pausing the transfer.
+ */
+typedef struct _HarNetwork {
+  gchar * preset;
+  gint64 download_kbps;
+  gint64 upload_kbps;
+  int latency;
+  int connect_latency;
+  long receive_buffer;
+} HarNetwork;
+
+/* from the WebPageTest connectivity profiles, latency is one round trip */
+static const struct {
+  const char * name;
+  gint64 download_kbps;
+  gint64 upload_kbps;
+  int latency;
+} har_network_presets[] = {
+  { "2g",      280,   256, 800 },
+  { "3g-slow", 400,   400, 400 },
+  { "3g",     1600,   768, 300 },
+  { "3g-fast", 1600,  768, 150 },
+  { "4g",     9000,  9000, 170 },
+  { "lte",   12000, 12000,  70 },
+  { "dsl",    1500,   384,  50 },
+  { "cable",  5000,  1000,  28 },
+  { "fios",  20000,  5000,   4 },
+  { "none",      0,     0,   0 },
+};
+
+void
+har_network_clear(HarNetwork * network)
+{
+  g_free(network->preset);
+  memset(network, 0, sizeof(*network));
+}
+
+void
+har_network_copy(HarNetwork * dest, const HarNetwork * src)
+{
+  *dest = *src;
+  dest->preset = g_strdup(src->preset);
+}
+
+gboolean
+har_network_is_set(const HarNetwork * network)
+{
+  return network->preset || network->download_kbps > 0 || network->upload_kbps > 0 ||
+    network->latency > 0 || network->connect_latency > 0 || network->receive_buffer > 0;
+}
+
+/* a preset sets the latency of new connections to one more round trip */
 int
-main(int argc, char *argv[])
+har_network_set_preset(HarNetwork * network, const char * name)
 {
-  CURLcode ret;
-  CURL * easy;
-  int status;
-  size_t flags;
-  json_t * entry;
-  json_t * resp;
-  json_t * req;
-  json_t * part;
-  json_error_t parse_error;
-  GError * option_error;
-  GOptionContext * options;
-  GTimeVal started;
-  GTimeVal ended;
-  g_get_current_time(&started);
-  char error[255];
+  int ix;
 
-  /* temp vars */
-  GByteArray * harbodyin = g_byte_array_new();
-  GByteArray * harheadout = g_byte_array_new();
-  GByteArray * harbodyout = g_byte_array_new();
-  GOptionEntry option_entries[] = {
-    { "verbose", 'v', 0, G_OPTION_ARG_NONE, &global_verbose,
-      "Add nonstandard HAR properties", NULL },
-    NULL
-  };
-  
-  /* parse args */
-  options = g_option_context_new("harcurl (" PACKAGE_VERSION ")");
-  g_option_context_add_main_entries(options, option_entries, NULL);
-  if (g_option_context_parse(options, &argc, &argv, &option_error) != TRUE) {
-    fprintf(stderr, "error parsing options\n");
+  for (ix = 0; ix < G_N_ELEMENTS(har_network_presets); ix++) {
+    if (g_ascii_strcasecmp(name, har_network_presets[ix].name)) continue;
+    har_network_clear(network);
+    network->preset = g_strdup(har_network_presets[ix].name);
+    network->download_kbps = har_network_presets[ix].download_kbps;
+    network->upload_kbps = har_network_presets[ix].upload_kbps;
+    network->latency = har_network_presets[ix].latency;
+    network->connect_latency = har_network_presets[ix].latency;
+    return HAR_OK;
   }
-  
-  /* load json */
-  flags = 0;
-  entry = json_loadf(stdin, flags, &parse_error);
-  if (!entry) {
-    fprintf(stderr, "no JSON could be decoded on standard input\n");
-    return HAR_ERROR_WITH_JSON;
-  }
-  json_object_set_new(entry, "response", json_object());
-  resp = json_object_get(entry, "response");
-  json_object_set_new(resp, "headersSize", json_integer(0));
-  json_object_set_new(resp, "bodySize", json_integer(0));
+  fprintf(stderr, "unknown network preset %s\n", name);
+  return HAR_ERROR_NETWORK_PROFILE;
+}
 
-  req = json_object_get(entry, "request");
-  if (!req || !json_is_object(req)) {
-    fprintf(stderr, "The request is missing\n");
-    return HAR_ERROR_NO_REQUEST;
+int
+har_network_set(HarNetwork * network, const char * key, gint64 value)
+{
+  if (value < 0) {
+    fprintf(stderr, "network %s cannot be negative\n", key);
+    return HAR_ERROR_NETWORK_PROFILE;
   }
-  part = json_object_get(req, "postData");
-  if (!part || !json_is_object(part)) {
-    json_object_set_new(req, "postData", json_object());
-    part = json_object_get(req, "postData");
-    json_object_set_new(req, "headersSize", json_integer(0));
-    json_object_set_new(req, "bodySize", json_integer(0));
-    if (global_verbose) {
-      json_object_set_new(part, "size", json_integer(0));
-    }
+  if (!strcmp(key, "downloadKbps")) {
+    network->download_kbps = value;
+  } else if (!strcmp(key, "uploadKbps")) {
+    network->upload_kbps = value;
+  } else if (!strcmp(key, "latency")) {
+    network->latency = (int)MIN(value, G_MAXINT);
+  } else if (!strcmp(key, "connectLatency")) {
+    network->connect_latency = (int)MIN(value, G_MAXINT);
+  } else if (!strcmp(key, "receiveBuffer")) {
+    network->receive_buffer = (long)value;
+  } else {
+    fprintf(stderr, "unknown network setting %s\n", key);
+    return HAR_ERROR_NETWORK_PROFILE;
   }
+  return HAR_OK;
+}
 
-  /* init curl */
-  easy = curl_easy_init();
-  if (!easy) {
-    fprintf(stderr, "no curl_easy handle\n");
-    return HAR_ERROR_WITH_CURL;
-  }
+/*
+ * har_network_parse:
+ *
+ * Reads "PRESET[,key=value...]" or "key=value[,...]", where
+ * the keys are the same as in entry._network, on top of
+ * the given profile.
+ */
+int
+har_network_parse(HarNetwork * network, const char * spec)
+{
+  int ix;
+  int status = HAR_OK;
+  gchar ** parts = g_strsplit(spec, ",", -1);
+  gchar * value;
+  gchar * end;
+  gint64 number;
+
+  for (ix = 0; parts[ix] && status == HAR_OK; ix++) {
+    g_strstrip(parts[ix]);
+    if (!*parts[ix]) continue;
+    value = strchr(parts[ix], '=');
+    if (!value) {
+      status = ix == 0 ? har_network_set_preset(network, parts[ix]) : HAR_ERROR_NETWORK_PROFILE;
+      continue;
+    }
+    *value++ = '\0';
+    number = g_ascii_strtoll(value, &end, 10);
+    if (end == value || *end) {
+      fprintf(stderr, "network %s is not a number: %s\n", parts[ix], value);
+      status = HAR_ERROR_NETWORK_PROFILE;
+      continue;
+    }
+    status = har_network_set(network, parts[ix], number);
+  }
+
+  g_strfreev(parts);
+  return status;
+}
+
+/* entry._network is either a string for har_network_parse, or an object */
+int
+har_network_from_json(HarNetwork * network, json_t * obj)
+{
+  const char * key;
+  json_t * value;
+  int status;
+
+  if (json_is_string(obj)) {
+    return har_network_parse(network, json_string_value(obj));
+  }
+  if (!json_is_object(obj)) {
+    fprintf(stderr, "entry._network must be a string or an object\n");
+    return HAR_ERROR_NETWORK_PROFILE;
+  }
+  value = json_object_get(obj, "preset");
+  if (json_is_string(value)) {
+    status = har_network_set_preset(network, json_string_value(value));
+    if (status != HAR_OK) return status;
+  }
+  json_object_foreach(obj, key, value) {
+    if (!strcmp(key, "preset") || !strcmp(key, "addedLatency")) continue;
+    if (!json_is_number(value)) {
+      fprintf(stderr, "entry._network.%s must be a number\n", key);
+      return HAR_ERROR_NETWORK_PROFILE;
+    }
+    status = har_network_set(network, key, (gint64)json_number_value(value));
+    if (status != HAR_OK) return status;
+  }
+  return HAR_OK;
+}
+
+json_t *
+har_network_to_json(const HarNetwork * network, double added_latency)
+{
+  json_t * obj = json_object();
+
+  if (network->preset) {
+    json_object_set_new(obj, "preset", json_string(network->preset));
+  }
+  json_object_set_new(obj, "downloadKbps", json_integer(network->download_kbps));
+  json_object_set_new(obj, "uploadKbps", json_integer(network->upload_kbps));
+  json_object_set_new(obj, "latency", json_integer(network->latency));
+  json_object_set_new(obj, "connectLatency", json_integer(network->connect_latency));
+  json_object_set_new(obj, "receiveBuffer", json_integer(network->receive_buffer));
+  json_object_set_new(obj, "addedLatency", json_real(added_latency));
+  return obj;
+}
+
+/*
+ * HarRun:
+ *
+ * State shared by all the entries of one harcurl
+ * invocation. Every curl_easy handle is attached to
+ * the same share, so that DNS lookups, TLS sessions and
+ * connections made by one entry (or by the warm-up
+ * stage) can be reused by the following entries.
+ */
+typedef struct _HarRun {
+  CURLSH * share;
+  struct curl_slist * resolve;
+  const char * cacert;
+  json_t * warmup;
+  int max_redirs;
+  HarNetwork network;
+
+  /* retries and hedging, see har_run_perform */
+  int retries;
+  int retry_delay;
+  int retry_max_delay;
+  int hedge;
+  GHashTable * hedge_origins;
+
+  /* per-origin scheduling, see HarScheduler */
+  int max_host_connections;
+  double rate;
+  int burst;
+  HarScheduler * scheduler;
+  json_t * scheduler_stats;
+
+  /* --compare --compare-mode concurrent: entries 2i and 2i+1 start together */
+  gboolean pairs;
+} HarRun;
+
+int
+har_run_init(HarRun * run)
+{
+  memset(run, 0, sizeof(*run));
+  run->share = curl_share_init();
+  if (!run->share) {
+    return HAR_ERROR_WITH_CURL;
+  }
+
+  curl_share_setopt(run->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(run->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  curl_share_setopt(run->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+  return HAR_OK;
+}
+
+void
+har_run_cleanup(HarRun * run)
+{
+  if (run->hedge_origins) {
+    g_hash_table_destroy(run->hedge_origins);
+  }
+  json_decref(run->scheduler_stats);
+  if (run->share) {
+    curl_share_cleanup(run->share);
+  }
+  curl_slist_free_all(run->resolve);
+  json_decref(run->warmup);
+  har_network_clear(&run->network);
+  memset(run, 0, sizeof(*run));
+}
+
+void
+har_run_to_curl_easy_setopt(HarRun * run, CURL * easy)
+{
+  curl_easy_setopt(easy, CURLOPT_SHARE, run->share);
+  if (run->resolve) {
+    curl_easy_setopt(easy, CURLOPT_RESOLVE, run->resolve);
+  }
+  if (run->cacert) {
+    curl_easy_setopt(easy, CURLOPT_CAINFO, run->cacert);
+  }
+#ifdef HAVE_OPENSSL
+  if (global_tls_sessions) {
+    curl_easy_setopt(easy, CURLOPT_SSL_CTX_FUNCTION, &har_ssl_ctx_callback);
+  }
+#endif
+}
+
+/*
+ * har_resolve_from_file:
+ *
+ * Reads static "host:port:address[,address]" pins, one per
+ * line, in the same format as CURLOPT_RESOLVE. Blank lines
+ * and lines starting with '#' are ignored.
+ */
+int
+har_resolve_from_file(const char * path, struct curl_slist ** resolve)
+{
+  int ix;
+  gchar * contents = NULL;
+  gchar ** lines;
+  GError * error = NULL;
+
+  if (!g_file_get_contents(path, &contents, NULL, &error)) {
+    fprintf(stderr, "unable to read %s: %s\n", path, error->message);
+    g_error_free(error);
+    return HAR_ERROR_UNKNOWN;
+  }
+
+  lines = g_strsplit(contents, "\n", -1);
+  for (ix = 0; lines[ix]; ++ix) {
+    gchar * line = g_strstrip(lines[ix]);
+    if (line[0] == '\0' || line[0] == '#') continue;
+    *resolve = curl_slist_append(*resolve, line);
+  }
+
+  g_strfreev(lines);
+  g_free(contents);
+  return HAR_OK;
+}
+
+gint
+har_strcmp_indirect(gconstpointer a, gconstpointer b)
+{
+  return strcmp(*(const char **)a, *(const char **)b);
+}
+
+gboolean
+har_resolve_is_pinned(struct curl_slist * resolve, const char * host, long port)
+{
+  gboolean result = FALSE;
+  gchar * prefix = g_strdup_printf("%s:%ld:", host, port);
+
+  for (; resolve && !result; resolve = resolve->next) {
+    result = !g_ascii_strncasecmp(resolve->data, prefix, strlen(prefix));
+  }
+
+  g_free(prefix);
+  return result;
+}
+
+/*
+ * har_url_to_origin:
+ *
+ * Returns "scheme://host:port" for the given url,
+ * with the default port filled in, or NULL.
+ */
+gchar *
+har_url_to_origin(const char * url, gchar ** host, long * port)
+{
+  CURLU * h = curl_url();
+  char * scheme_part = NULL;
+  char * host_part = NULL;
+  char * port_part = NULL;
+  gchar * origin = NULL;
+
+  if (curl_url_set(h, CURLUPART_URL, url, 0) == CURLUE_OK &&
+      curl_url_get(h, CURLUPART_SCHEME, &scheme_part, 0) == CURLUE_OK &&
+      curl_url_get(h, CURLUPART_HOST, &host_part, 0) == CURLUE_OK &&
+      curl_url_get(h, CURLUPART_PORT, &port_part, CURLU_DEFAULT_PORT) == CURLUE_OK) {
+    origin = g_strdup_printf("%s://%s:%s", scheme_part, host_part, port_part);
+    if (host) *host = g_strdup(host_part);
+    if (port) *port = strtol(port_part, NULL, 10);
+  }
+
+  curl_free(scheme_part);
+  curl_free(host_part);
+  curl_free(port_part);
+  curl_url_cleanup(h);
+  return origin;
+}
+
+/*
+ * HarWarmupMode:
+ *
+ * How far the warm-up stage goes for every origin.
+ * Note that libcurl never hands a CURLOPT_CONNECT_ONLY
+ * connection to another transfer, so "connect" only primes
+ * the DNS and TLS session caches, and "head" is needed to
+ * leave an open connection in the shared pool.
+ */
+typedef enum _HarWarmupMode {
+  HAR_WARMUP_NONE = 0,
+  HAR_WARMUP_DNS,
+  HAR_WARMUP_CONNECT,
+  HAR_WARMUP_HEAD,
+} HarWarmupMode;
+
+typedef struct _HarWarmupOrigin {
+  gchar * origin;
+  gchar * host;
+  long port;
+  gchar * pin;
+  double dns;
+  CURL * easy;
+} HarWarmupOrigin;
+
+void
+har_warmup_resolve_thread(gpointer data, gpointer user_data)
+{
+  HarWarmupOrigin * wo = (HarWarmupOrigin *)data;
+  struct addrinfo hints;
+  struct addrinfo * ai = NULL;
+  struct addrinfo * it;
+  char addr[INET6_ADDRSTRLEN + 2];
+  gint64 started = g_get_monotonic_time();
+  GString * pin;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(wo->host, NULL, &hints, &ai) != 0) {
+    wo->dns = -1;
+    return;
+  }
+  wo->dns = (1.0e-3)*(double)(g_get_monotonic_time() - started);
+
+  pin = g_string_new(NULL);
+  g_string_printf(pin, "%s:%ld:", wo->host, wo->port);
+  for (it = ai; it; it = it->ai_next) {
+    const void * sa = it->ai_family == AF_INET6 ?
+      (const void *)&((struct sockaddr_in6 *)it->ai_addr)->sin6_addr :
+      (const void *)&((struct sockaddr_in *)it->ai_addr)->sin_addr;
+    if (!inet_ntop(it->ai_family, sa, addr + 1, INET6_ADDRSTRLEN)) continue;
+    if (it->ai_family == AF_INET6) {
+      addr[0] = '[';
+      strcat(addr, "]");
+      g_string_append(pin, addr);
+    } else {
+      g_string_append(pin, addr + 1);
+    }
+    if (it->ai_next) g_string_append_c(pin, ',');
+  }
+  freeaddrinfo(ai);
+  wo->pin = g_string_free(pin, FALSE);
+}
+
+/*
+ * har_run_warmup:
+ *
+ * Scans the entries for distinct origins, resolves them in
+ * parallel and (depending on the mode) connects to them,
+ * up to --parallel at a time, all before the first entry
+ * is sent, so that the first entry to every origin is not
+ * charged for the setup. The time spent here goes into
+ * run->warmup, never into the timings of an entry.
+ */
+int
+har_run_warmup(HarRun * run, json_t * entries, HarWarmupMode mode, int parallel)
+{
+  int ix;
+  int running = 0;
+  json_t * entry;
+  json_t * origins_json = json_array();
+  GPtrArray * origins = g_ptr_array_new();
+  GHashTable * seen = g_hash_table_new(g_str_hash, g_str_equal);
+  GThreadPool * resolvers;
+  GError * error = NULL;
+  CURLM * multi;
+  gint64 started = g_get_monotonic_time();
+
+  json_array_foreach(entries, ix, entry) {
+    const char * url = json_string_value(json_object_get(json_object_get(entry, "request"), "url"));
+    HarWarmupOrigin * wo;
+    gchar * origin;
+    if (!url) continue;
+    origin = har_url_to_origin(url, NULL, NULL);
+    if (!origin || g_hash_table_contains(seen, origin)) {
+      g_free(origin);
+      continue;
+    }
+    wo = g_new0(HarWarmupOrigin, 1);
+    wo->origin = origin;
+    g_free(har_url_to_origin(url, &wo->host, &wo->port));
+    g_hash_table_insert(seen, origin, wo);
+    g_ptr_array_add(origins, wo);
+  }
+
+  /* resolve every origin in a pool of threads, unless it was pinned */
+  resolvers = g_thread_pool_new(&har_warmup_resolve_thread, NULL, MAX(parallel, 1), FALSE, &error);
+  if (!resolvers) {
+    fprintf(stderr, "unable to start resolver threads: %s\n", error->message);
+    g_error_free(error);
+  }
+  for (ix = 0; ix < origins->len; ix++) {
+    HarWarmupOrigin * wo = g_ptr_array_index(origins, ix);
+    if (har_resolve_is_pinned(run->resolve, wo->host, wo->port)) {
+      wo->dns = -1;
+    } else if (resolvers) {
+      g_thread_pool_push(resolvers, wo, NULL);
+    } else {
+      har_warmup_resolve_thread(wo, NULL);
+    }
+  }
+  if (resolvers) {
+    g_thread_pool_free(resolvers, FALSE, TRUE);
+  }
+  for (ix = 0; ix < origins->len; ix++) {
+    HarWarmupOrigin * wo = g_ptr_array_index(origins, ix);
+    if (wo->pin) {
+      run->resolve = curl_slist_append(run->resolve, wo->pin);
+    }
+  }
+
+  /* connect to every origin, --parallel at a time */
+  if (mode >= HAR_WARMUP_CONNECT) {
+    multi = curl_multi_init();
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)MAX(parallel, 1));
+    for (ix = 0; ix < origins->len; ix++) {
+      HarWarmupOrigin * wo = g_ptr_array_index(origins, ix);
+      wo->easy = curl_easy_init();
+      har_run_to_curl_easy_setopt(run, wo->easy);
+      curl_easy_setopt(wo->easy, CURLOPT_URL, wo->origin);
+      if (mode == HAR_WARMUP_HEAD) {
+        curl_easy_setopt(wo->easy, CURLOPT_NOBODY, 1L);
+      } else {
+        curl_easy_setopt(wo->easy, CURLOPT_CONNECT_ONLY, 1L);
+      }
+      curl_multi_add_handle(multi, wo->easy);
+    }
+
+    do {
+      curl_multi_perform(multi, &running);
+      if (running) {
+        curl_multi_poll(multi, NULL, 0, 1000, NULL);
+      }
+    } while (running);
+
+    for (ix = 0; ix < origins->len; ix++) {
+      HarWarmupOrigin * wo = g_ptr_array_index(origins, ix);
+      curl_multi_remove_handle(multi, wo->easy);
+    }
+    curl_multi_cleanup(multi);
+  }
+
+  for (ix = 0; ix < origins->len; ix++) {
+    HarWarmupOrigin * wo = g_ptr_array_index(origins, ix);
+    json_t * origin_json = json_object();
+    json_object_set_new(origin_json, "origin", json_string(wo->origin));
+    json_object_set_new(origin_json, "dns", json_real(wo->dns));
+    if (wo->easy) {
+      curl_off_t connect = 0;
+      curl_off_t appconnect = 0;
+      curl_off_t total = 0;
+      curl_easy_getinfo(wo->easy, CURLINFO_CONNECT_TIME_T, &connect);
+      curl_easy_getinfo(wo->easy, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+      curl_easy_getinfo(wo->easy, CURLINFO_TOTAL_TIME_T, &total);
+      json_object_set_new(origin_json, "connect", json_real(har_timing_ms(0, appconnect ? appconnect : connect)));
+      json_object_set_new(origin_json, "ssl", json_real(har_timing_ms(connect, appconnect)));
+      json_object_set_new(origin_json, "time", json_real(har_timing_ms(0, total)));
+      curl_easy_cleanup(wo->easy);
+    }
+    json_array_append_new(origins_json, origin_json);
+    g_free(wo->origin);
+    g_free(wo->host);
+    g_free(wo->pin);
+    g_free(wo);
+  }
+  g_ptr_array_free(origins, TRUE);
+  g_hash_table_destroy(seen);
+
+  run->warmup = json_object();
+  json_object_set_new(run->warmup, "time", json_real((1.0e-3)*(double)(g_get_monotonic_time() - started)));
+  json_object_set_new(run->warmup, "origins", origins_json);
+  return HAR_OK;
+}
+
+/*
+ * har_entry_prepare:
+ *
+ * Makes sure that the entry has the objects
+ * that the rest of harcurl expects to be there.
+ */
+int
+har_entry_prepare(json_t * entry)
+{
+  json_t * resp;
+  json_t * req;
+  json_t * part;
+
+  json_object_set_new(entry, "response", json_object());
+  resp = json_object_get(entry, "response");
+  json_object_set_new(resp, "headersSize", json_integer(0));
+  json_object_set_new(resp, "bodySize", json_integer(0));
+
+  req = json_object_get(entry, "request");
+  if (!req || !json_is_object(req)) {
+    return HAR_ERROR_NO_REQUEST;
+  }
+  /* HAR requires them, and only a protocol that sends some (not file://) fills them in */
+  if (!json_is_array(json_object_get(req, "headers"))) {
+    json_object_set_new(req, "headers", json_array());
+  }
+  part = json_object_get(req, "postData");
+  if (!part || !json_is_object(part)) {
+    json_object_set_new(req, "postData", json_object());
+    part = json_object_get(req, "postData");
+    json_object_set_new(req, "headersSize", json_integer(0));
+    json_object_set_new(req, "bodySize", json_integer(0));
+    if (global_verbose) {
+      json_object_set_new(part, "size", json_integer(0));
+    }
+  }
+
+  return HAR_OK;
+}
+
+/*
+ * HarTransfer:
+ *
+ * One entry on its way through the pipeline:
+ * the network stage (curl_multi, on the main thread),
+ * the post-processing stage (a pool of worker threads
+ * which decode, validate, encode and serialize), and
+ * the writer stage (a single thread which owns stdout).
+ * A transfer is only ever touched by one stage at a time.
+ */
+typedef struct _HarTransfer {
+  int index;
+  int status;
+  json_t * entry;
+  CURL * easy;
+  GByteArray * harbodyin;
+  GByteArray * harheadout;
+  GByteArray * harbodyout;
+  GTimeVal started;
+  gboolean performed;
+  gchar * text;
+  HarPhaseClock perform;
+  HarProfile profile;
+
+  /* the entry as it was before it was sent, from which
+   * the next hop (har_transfer_redirect) or the next attempt
+   * (har_transfer_again) is made; it is never changed */
+  json_t * entry_template;
+
+  /* redirect chains */
+  int hop;
+  gboolean last;
+  double chain_time;
+
+  /* retries and hedging */
+  int attempt;
+  int attempts_started;
+  int retry;
+  json_t * attempts;
+  gchar * origin;
+  struct _HarTransfer * sibling;
+  gboolean is_hedge;
+  gboolean hedged;
+  GTimeVal first_started;
+  gint64 performing;
+  gint64 responded;
+  gint64 not_before;
+  double delay;
+
+  /* network emulation, see HarNetwork */
+  HarNetwork network;
+  gboolean emulated;
+  int connects;
+  gboolean latency_added;
+  gint64 paused;
+  gint64 resume;
+  double added_latency;
+  gint64 receiving;
+  gint64 received;
+
+  /* --events */
+  gboolean request_sent;
+  gsize headers_block;
+  gint64 progressed;
+  curl_off_t progressed_bytes;
+} HarTransfer;
+
+/* the writer orders transfers by entry index, then by hop */
+#define HAR_REDIRECT_HOPS_MAX 64
+#define HAR_TRANSFER_KEY(index, hop) GSIZE_TO_POINTER((gsize)(index) * HAR_REDIRECT_HOPS_MAX + (hop))
+
+typedef struct _HarPipeline {
+  GThreadPool * workers;
+  GAsyncQueue * output;
+  GThread * writer;
+  FILE * stream;
+  gboolean is_log;
+  int count;
+  int parallel;
+  int nworkers;
+
+  /* stats, guarded by lock */
+  GMutex lock;
+  gint64 started;
+  gint64 network_busy;
+  gint64 postprocess_busy;
+  gint64 writer_busy;
+  guint postprocess_queue_max;
+  guint output_queue_max;
+  HarProfile profile;
+
+  /* only touched by the writer */
+  HarCompare * compare;
+  struct _HarCapture * capture;
+  HarJournal * journal;
+  int first;
+} HarPipeline;
+
+HarTransfer *
+har_transfer_new(int index, json_t * entry)
+{
+  HarTransfer * transfer = g_new0(HarTransfer, 1);
+  transfer->index = index;
+  transfer->last = TRUE;
+  transfer->entry = json_incref(entry);
+  transfer->harbodyin = g_byte_array_new();
+  transfer->harheadout = g_byte_array_new();
+  transfer->harbodyout = g_byte_array_new();
+  return transfer;
+}
+
+void
+har_transfer_free(HarTransfer * transfer)
+{
+  if (transfer->easy) {
+    curl_easy_cleanup(transfer->easy);
+  }
+  if (transfer->harbodyin) {
+    g_byte_array_free(transfer->harbodyin, TRUE);
+  }
+  if (transfer->harheadout) {
+    g_byte_array_free(transfer->harheadout, TRUE);
+  }
+  if (transfer->harbodyout) {
+    g_byte_array_free(transfer->harbodyout, TRUE);
+  }
+  json_decref(transfer->entry);
+  json_decref(transfer->entry_template);
+  json_decref(transfer->attempts);
+  har_network_clear(&transfer->network);
+  g_free(transfer->origin);
+  g_free(transfer->text);
+  g_free(transfer);
+}
+
+/*
+ * har_events_emit:
+ *
+ * With --events, stdout is a stream of JSON objects, one
+ * per line, written by the network stage (request_sent,
+ * headers_received, progress) and by the workers (complete)
+ * as things happen. Every event has the index, hop and
+ * attempt of its entry, and the milliseconds since the run
+ * started. The fields are stolen, and entry_text (already
+ * serialized, compact) is added as "entry".
+ */
+static GMutex global_events_lock;
+static gint64 global_events_started = 0;
+
+void
+har_events_emit(const char * event, HarTransfer * transfer, json_t * fields, const char * entry_text)
+{
+  json_t * obj = json_object();
+  gchar * text;
+  gsize len;
+
+  json_object_set_new(obj, "event", json_string(event));
+  if (transfer) {
+    json_object_set_new(obj, "index", json_integer(transfer->index));
+    json_object_set_new(obj, "hop", json_integer(transfer->hop));
+    json_object_set_new(obj, "attempt", json_integer(MAX(transfer->attempt, 1)));
+  }
+  json_object_set_new(obj, "time", json_real((1.0e-3)*(double)(g_get_monotonic_time() - global_events_started)));
+  if (fields) {
+    json_object_update(obj, fields);
+    json_decref(fields);
+  }
+  text = json_dumps(obj, JSON_PRESERVE_ORDER | JSON_COMPACT);
+  len = strlen(text);
+
+  g_mutex_lock(&global_events_lock);
+  if (entry_text) {
+    fwrite(text, 1, len - 1, stdout);
+    fputs(",\"entry\":", stdout);
+    fputs(entry_text, stdout);
+    fputs("}\n", stdout);
+  } else {
+    fputs(text, stdout);
+    fputc('\n', stdout);
+  }
+  fflush(stdout);
+  g_mutex_unlock(&global_events_lock);
+
+  free(text);
+  json_decref(obj);
+}
+
+void
+har_events_request_sent(HarTransfer * transfer)
+{
+  char * url = NULL;
+  json_t * req = json_object_get(transfer->entry, "request");
+
+  /* progress is counted from here, whichever callback sees it first */
+  transfer->request_sent = TRUE;
+  transfer->progressed = g_get_monotonic_time();
+  transfer->progressed_bytes = 0;
+  curl_easy_getinfo(transfer->easy, CURLINFO_EFFECTIVE_URL, &url);
+  har_events_emit("request_sent", transfer,
+                  json_pack("{s:O,s:s}",
+                            "method", json_object_get(req, "method"),
+                            "url", url ? url : ""),
+                  NULL);
+}
+
+/* the header block that just ended, from its status line */
+void
+har_events_headers_received(HarTransfer * transfer)
+{
+  GByteArray * bytes = transfer->harheadout;
+  gchar * block = g_strndup((const gchar *)bytes->data + transfer->headers_block,
+                            bytes->len - transfer->headers_block);
+  gchar * first = g_strndup(block, strcspn(block, "\r\n"));
+  gchar ** status_line = g_strsplit(first, " ", 3);
+  json_t * headers = json_array();
+
+  transfer->headers_block = bytes->len;
+  har_headers_from_text(headers, block, strlen(block));
+  if (status_line[0] && status_line[1]) {
+    har_events_emit("headers_received", transfer,
+                    json_pack("{s:s,s:i,s:s,s:o}",
+                              "httpVersion", status_line[0],
+                              "status", atoi(status_line[1]),
+                              "statusText", status_line[2] ? status_line[2] : "",
+                              "headers", headers),
+                    NULL);
+  } else {
+    json_decref(headers);
+  }
+
+  g_strfreev(status_line);
+  g_free(first);
+  g_free(block);
+}
+
+/*
+ * har_events_progress_callback:
+ *
+ * The CURLOPT_XFERINFOFUNCTION of every transfer with --events.
+ * Emits request_sent once the request (and its body) is out,
+ * and progress every --events-interval milliseconds, with the
+ * rate in bytes per second since the previous progress event.
+ */
+static int global_events_interval = 1000;
+
+int
+har_events_progress_callback(void * transferptr,
+                             curl_off_t dltotal,
+                             curl_off_t dlnow,
+                             curl_off_t ultotal,
+                             curl_off_t ulnow)
+{
+  HarTransfer * transfer = (HarTransfer *)transferptr;
+  gint64 now = g_get_monotonic_time();
+  curl_off_t pretransfer = 0;
+  double rate;
+
+  if (!transfer->request_sent) {
+    curl_easy_getinfo(transfer->easy, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+    if (pretransfer > 0 && ulnow >= ultotal) {
+      har_events_request_sent(transfer);
+    }
+    return 0;
+  }
+  if (now - transfer->progressed < (gint64)1000 * global_events_interval) {
+    return 0;
+  }
+
+  rate = (1.0e6)*(double)(dlnow - transfer->progressed_bytes)/(double)(now - transfer->progressed);
+  transfer->progressed = now;
+  transfer->progressed_bytes = dlnow;
+  har_events_emit("progress", transfer,
+                  json_pack("{s:I,s:I,s:I,s:I,s:f}",
+                            "downloaded", (json_int_t)dlnow,
+                            "downloadTotal", (json_int_t)dltotal,
+                            "uploaded", (json_int_t)ulnow,
+                            "uploadTotal", (json_int_t)ultotal,
+                            "rate", rate),
+                  NULL);
+  return 0;
+}
+
+/*
+ * har_pipeline_postprocess:
+ *
+ * Runs on the worker threads, so that the network
+ * stage can go back to servicing sockets.
+ */
+void
+har_pipeline_postprocess(gpointer data, gpointer user_data)
+{
+  HarTransfer * transfer = (HarTransfer *)data;
+  HarPipeline * pipeline = (HarPipeline *)user_data;
+  gint64 started = g_get_monotonic_time();
+  guint depth;
+  HarPhaseClock clock;
+
+  if (transfer->performed) {
+    har_entry_from_byte_arrays(transfer->entry, transfer->harheadout, &transfer->harbodyout,
+                               &transfer->profile, transfer->index);
+    har_compare_digest(transfer->entry, transfer->harbodyout);
+  }
+  /* the timings of an entry end where its dump begins, which only the totals of the log have */
+  if (global_profile) {
+    json_object_set_new(transfer->entry, "_harcurlTimings", har_profile_to_json(&transfer->profile, FALSE));
+  }
+  har_phase_begin(&clock, HAR_PHASE_DUMP, transfer->index);
+  if (pipeline->capture) {
+    transfer->text = har_capture_skeleton(transfer->entry);
+  } else {
+    transfer->text = json_dumps(transfer->entry, JSON_SORT_KEYS |
+                                (global_events ? JSON_COMPACT : JSON_INDENT(2)));
+  }
+  har_phase_end(&transfer->profile, &clock, HAR_PHASE_DUMP, transfer->index);
+  if (global_profile) {
+    g_mutex_lock(&pipeline->lock);
+    har_profile_add(&pipeline->profile, &transfer->profile);
+    g_mutex_unlock(&pipeline->lock);
+  }
+  if (global_events) {
+    char error[1024];
+    json_t * fields = NULL;
+    if (transfer->status != HAR_OK) {
+      har_strerror(transfer->status, error, sizeof(error));
+      fields = json_pack("{s:s}", "error", error);
+    }
+    har_events_emit("complete", transfer, fields, transfer->text ? transfer->text : "null");
+  }
+
+  /* the raw buffers are not needed anymore, but for the body of a capture */
+  g_byte_array_free(transfer->harheadout, TRUE);
+  transfer->harheadout = NULL;
+  if (!pipeline->capture || !transfer->performed) {
+    g_byte_array_free(transfer->harbodyout, TRUE);
+    transfer->harbodyout = NULL;
+  }
+
+  g_async_queue_push(pipeline->output, transfer);
+  depth = (guint)MAX(0, g_async_queue_length(pipeline->output));
+
+  g_mutex_lock(&pipeline->lock);
+  pipeline->postprocess_busy += g_get_monotonic_time() - started;
+  pipeline->output_queue_max = MAX(pipeline->output_queue_max, depth);
+  g_mutex_unlock(&pipeline->lock);
+}
+
+/*
+ * har_pipeline_writer_thread:
+ *
+ * Writes the serialized entries in their original order,
+ * whatever order they finish in, with the hops of a
+ * redirect chain right after the entry that started it.
+ */
+gpointer
+har_pipeline_writer_thread(gpointer data)
+{
+  HarPipeline * pipeline = (HarPipeline *)data;
+  GHashTable * pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+  HarTransfer * transfer;
+  int next = 0;
+  int hop = 0;
+  int written = 0;
+
+  while (next < pipeline->count) {
+    transfer = (HarTransfer *)g_async_queue_pop(pipeline->output);
+    gint64 started = g_get_monotonic_time();
+    g_hash_table_insert(pending, HAR_TRANSFER_KEY(transfer->index, transfer->hop), transfer);
+
+    while ((transfer = g_hash_table_lookup(pending, HAR_TRANSFER_KEY(next, hop)))) {
+      g_hash_table_remove(pending, HAR_TRANSFER_KEY(next, hop));
+      /* with --events, the worker wrote it as a complete event */
+      if (pipeline->capture) {
+        /* the capture keeps its first error, which har_capture_close returns for the run */
+        json_t * req = json_object_get(transfer->entry, "request");
+        json_t * resp = json_object_get(transfer->entry, "response");
+        har_capture_add(pipeline->capture, transfer->index, transfer->hop,
+                        transfer->text ? transfer->text : "null",
+                        json_object_get(req, "headers"), json_object_get(resp, "headers"),
+                        transfer->harbodyout);
+      } else if (!global_events) {
+        /* with --resume, the entries before pipeline->first are already there */
+        if (pipeline->is_log && (written > 0 || pipeline->first > 0)) {
+          fputs(",\n", pipeline->stream);
+        }
+        if (transfer->text) {
+          fputs(transfer->text, pipeline->stream);
+        } else {
+          fputs("null", pipeline->stream);
+        }
+      }
+      written++;
+      if (transfer->last && pipeline->compare) {
+        har_compare_add(pipeline->compare, transfer->entry);
+      }
+      if (transfer->last && pipeline->journal) {
+        har_journal_add(pipeline->journal, pipeline->first + next, ftell(pipeline->stream));
+      }
+      if (transfer->last) {
+        next++;
+        hop = 0;
+      } else {
+        hop++;
+      }
+      har_transfer_free(transfer);
+    }
+
+    g_mutex_lock(&pipeline->lock);
+    pipeline->writer_busy += g_get_monotonic_time() - started;
+    g_mutex_unlock(&pipeline->lock);
+  }
+
+  fflush(pipeline->stream);
+  g_hash_table_destroy(pending);
+  return NULL;
+}
+
+int
+har_pipeline_init(HarPipeline * pipeline, int count, int parallel, int nworkers, gboolean is_log)
+{
+  GError * error = NULL;
+
+  memset(pipeline, 0, sizeof(*pipeline));
+  g_mutex_init(&pipeline->lock);
+  pipeline->stream = stdout;
+  pipeline->is_log = is_log;
+  pipeline->count = count;
+  pipeline->parallel = parallel > 0 ? parallel : 1;
+  pipeline->nworkers = nworkers > 0 ? nworkers : (int)g_get_num_processors();
+  pipeline->started = g_get_monotonic_time();
+  pipeline->output = g_async_queue_new();
+  pipeline->workers = g_thread_pool_new(&har_pipeline_postprocess, pipeline,
+                                        pipeline->nworkers, TRUE, &error);
+  if (!pipeline->workers) {
+    fprintf(stderr, "unable to start worker threads: %s\n", error->message);
+    g_error_free(error);
+    return HAR_ERROR_UNKNOWN;
+  }
+  pipeline->writer = g_thread_new("harcurl-writer", &har_pipeline_writer_thread, pipeline);
+  return HAR_OK;
+}
+
+/*
+ * har_pipeline_finish:
+ *
+ * Waits for the workers and the writer to drain, and
+ * returns the pipeline stats, so that the pool can be sized.
+ */
+json_t *
+har_pipeline_finish(HarPipeline * pipeline)
+{
+  json_t * stats = json_object();
+
+  g_thread_pool_free(pipeline->workers, FALSE, TRUE);
+  g_thread_join(pipeline->writer);
+  g_async_queue_unref(pipeline->output);
+
+  json_object_set_new(stats, "parallel", json_integer(pipeline->parallel));
+  json_object_set_new(stats, "workers", json_integer(pipeline->nworkers));
+  json_object_set_new(stats, "time", json_real((1.0e-3)*(double)(g_get_monotonic_time() - pipeline->started)));
+  json_object_set_new(stats, "networkBusy", json_real((1.0e-3)*(double)pipeline->network_busy));
+  json_object_set_new(stats, "postprocessBusy", json_real((1.0e-3)*(double)pipeline->postprocess_busy));
+  json_object_set_new(stats, "writerBusy", json_real((1.0e-3)*(double)pipeline->writer_busy));
+  json_object_set_new(stats, "postprocessQueueMax", json_integer(pipeline->postprocess_queue_max));
+  json_object_set_new(stats, "writerQueueMax", json_integer(pipeline->output_queue_max));
+  g_mutex_clear(&pipeline->lock);
+  return stats;
+}
+
+void
+har_pipeline_push(HarPipeline * pipeline, HarTransfer * transfer)
+{
+  guint depth;
+
+  g_thread_pool_push(pipeline->workers, transfer, NULL);
+  depth = g_thread_pool_unprocessed(pipeline->workers);
+
+  g_mutex_lock(&pipeline->lock);
+  pipeline->postprocess_queue_max = MAX(pipeline->postprocess_queue_max, depth);
+  g_mutex_unlock(&pipeline->lock);
+}
+
+/*
+ * har_transfer_header_callback:
+ *
+ * Stands in for har_header_callback when latency is
+ * emulated, with --hedge (which keeps when the response
+ * began to come in), or with --events. The first time it is called
+ * with latency, the transfer is paused, and libcurl hands
+ * the same bytes over again once har_run_perform resumes it.
+ * A blank line ends a header block (there may be several,
+ * after 1xx responses), which is a headers_received event.
+ */
+size_t
+har_transfer_header_callback(const void * ptr,
+                             size_t size,
+                             size_t nitems,
+                             void * transferptr)
+{
+  HarTransfer * transfer = (HarTransfer *)transferptr;
+  size_t ptrlen = size*nitems;
+  int latency = transfer->network.latency;
+
+  if (!transfer->latency_added && transfer->emulated) {
+    transfer->latency_added = TRUE;
+    if (transfer->connects > 0) {
+      latency += transfer->network.connect_latency;
+    }
+    if (latency > 0) {
+      transfer->paused = g_get_monotonic_time();
+      transfer->resume = transfer->paused + (gint64)1000 * latency;
+      return CURL_WRITEFUNC_PAUSE;
+    }
+  }
+
+  if (!transfer->responded) {
+    transfer->responded = g_get_monotonic_time();
+  }
+  har_header_callback(ptr, size, nitems, transfer->harheadout);
+  if (global_events) {
+    if (!transfer->request_sent) {
+      har_events_request_sent(transfer);
+    }
+    if ((ptrlen == 2 && !memcmp(ptr, "\r\n", 2)) || (ptrlen == 1 && *(const char *)ptr == '\n')) {
+      har_events_headers_received(transfer);
+    }
+  }
+  return ptrlen;
+}
+
+/* holds back the body until it could have come in at downloadKbps */
+size_t
+har_network_write_callback(const void * ptr,
+                           size_t size,
+                           size_t nitems,
+                           void * transferptr)
+{
+  HarTransfer * transfer = (HarTransfer *)transferptr;
+  gint64 now = g_get_monotonic_time();
+  gint64 due;
+
+  if (!transfer->receiving) {
+    transfer->receiving = now;
+  }
+  due = transfer->receiving +
+    (transfer->received + (gint64)(size*nitems)) * 8000 / transfer->network.download_kbps;
+  if (due > now + 1000) {
+    transfer->resume = due;
+    return CURL_WRITEFUNC_PAUSE;
+  }
+  transfer->received += size*nitems;
+  return har_write_callback(ptr, size, nitems, transfer->harbodyout);
+}
+
+/* called for every new connection of the transfer */
+int
+har_network_sockopt_callback(void * transferptr,
+                             curl_socket_t curlfd,
+                             curlsocktype purpose)
+{
+  HarTransfer * transfer = (HarTransfer *)transferptr;
+  int size = (int)MIN(transfer->network.receive_buffer, G_MAXINT);
+
+  transfer->connects++;
+  if (size > 0 && purpose == CURLSOCKTYPE_IPCXN) {
+    setsockopt(curlfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  }
+  return CURL_SOCKOPT_OK;
+}
+
+/*
+ * har_transfer_network:
+ *
+ * Applies the network profile of the run, with the
+ * entry._network of the entry on top of it.
+ */
+int
+har_transfer_network(HarRun * run, HarTransfer * transfer)
+{
+  int status;
+  json_t * obj = json_object_get(transfer->entry, "_network");
+
+  har_network_clear(&transfer->network);
+  har_network_copy(&transfer->network, &run->network);
+  if (obj) {
+    status = har_network_from_json(&transfer->network, obj);
+    if (status != HAR_OK) {
+      return status;
+    }
+  }
+  transfer->emulated = har_network_is_set(&transfer->network) || obj;
+  if (!transfer->emulated) {
+    return HAR_OK;
+  }
+
+  if (transfer->network.download_kbps > 0) {
+    curl_easy_setopt(transfer->easy, CURLOPT_MAX_RECV_SPEED_LARGE,
+                     (curl_off_t)(transfer->network.download_kbps * 1000 / 8));
+    curl_easy_setopt(transfer->easy, CURLOPT_WRITEDATA, transfer);
+    curl_easy_setopt(transfer->easy, CURLOPT_WRITEFUNCTION, &har_network_write_callback);
+  }
+  if (transfer->network.upload_kbps > 0) {
+    curl_easy_setopt(transfer->easy, CURLOPT_MAX_SEND_SPEED_LARGE,
+                     (curl_off_t)(transfer->network.upload_kbps * 1000 / 8));
+  }
+  if (transfer->network.receive_buffer > 0) {
+    curl_easy_setopt(transfer->easy, CURLOPT_BUFFERSIZE, MAX(transfer->network.receive_buffer, 1024L));
+  }
+  curl_easy_setopt(transfer->easy, CURLOPT_SOCKOPTDATA, transfer);
+  curl_easy_setopt(transfer->easy, CURLOPT_SOCKOPTFUNCTION, &har_network_sockopt_callback);
+  if (transfer->network.latency > 0 || transfer->network.connect_latency > 0) {
+    curl_easy_setopt(transfer->easy, CURLOPT_HEADERDATA, transfer);
+    curl_easy_setopt(transfer->easy, CURLOPT_HEADERFUNCTION, &har_transfer_header_callback);
+  }
+  return HAR_OK;
+}
+
+/*
+ * har_transfer_network_timings:
+ *
+ * libcurl counts the pause in "receive", since it starts
+ * after the first byte came in, so the added latency is
+ * moved to "connect" (for a new connection) and "wait",
+ * where it would be on a slow network.
+ */
+void
+har_transfer_network_timings(HarTransfer * transfer)
+{
+  json_t * timings = json_object_get(transfer->entry, "timings");
+  double connect = json_number_value(json_object_get(timings, "connect"));
+  double wait = json_number_value(json_object_get(timings, "wait"));
+  double receive = json_number_value(json_object_get(timings, "receive"));
+  double added = transfer->added_latency;
+  double to_connect = 0;
+
+  if (added > 0 && receive >= 0) {
+    if (transfer->connects > 0 && connect >= 0) {
+      to_connect = MIN(added, (double)transfer->network.connect_latency);
+      json_object_set_new(timings, "connect", json_real(connect + to_connect));
+    }
+    json_object_set_new(timings, "wait", json_real(MAX(wait, 0) + added - to_connect));
+    json_object_set_new(timings, "receive", json_real(MAX(receive - added, 0)));
+  }
+  json_object_set_new(transfer->entry, "_network",
+                      har_network_to_json(&transfer->network, transfer->added_latency));
+}
+
+/*
+ * har_transfer_start:
+ *
+ * Prepares the curl_easy handle of one entry.
+ * On error, the entry is passed on as it is.
+ */
+int
+har_transfer_start(HarRun * run, HarTransfer * transfer)
+{
+  int status;
+  char error[1024];
+  HarPhaseClock clock;
+
+  status = har_entry_prepare(transfer->entry);
+  if (status != HAR_OK) {
+    har_strerror(status, error, sizeof(error));
+    fprintf(stderr, "%s\n", error);
+    return status;
+  }
+  g_get_current_time(&transfer->started);
+
+  /* init curl */
+  transfer->easy = curl_easy_init();
+  if (!transfer->easy) {
+    fprintf(stderr, "no curl_easy handle\n");
+    return HAR_ERROR_WITH_CURL;
+  }
+  har_run_to_curl_easy_setopt(run, transfer->easy);
+  curl_easy_setopt(transfer->easy, CURLOPT_PRIVATE, transfer);
+
+  /* transform */
+  har_phase_begin(&clock, HAR_PHASE_SETOPT, transfer->index);
+  status = har_entry_to_curl_easy_setopt(transfer->entry, transfer->easy,
+                                         transfer->harbodyin,
+                                         transfer->harheadout,
+                                         transfer->harbodyout);
+  har_phase_end(&transfer->profile, &clock, HAR_PHASE_SETOPT, transfer->index);
+  if (status != HAR_OK) {
+    har_strerror(status, error, sizeof(error));
+    fprintf(stderr, "unable to transform har_entry object to curl_easy handle: %s\n", error);
+    curl_easy_cleanup(transfer->easy);
+    transfer->easy = NULL;
+    return status;
+  }
+
+  status = har_transfer_network(run, transfer);
+  if (status != HAR_OK) {
+    har_strerror(status, error, sizeof(error));
+    fprintf(stderr, "%s\n", error);
+    curl_easy_cleanup(transfer->easy);
+    transfer->easy = NULL;
+    return status;
+  }
+  if (global_events || run->hedge) {
+    curl_easy_setopt(transfer->easy, CURLOPT_HEADERDATA, transfer);
+    curl_easy_setopt(transfer->easy, CURLOPT_HEADERFUNCTION, &har_transfer_header_callback);
+  }
+  if (global_events) {
+    curl_easy_setopt(transfer->easy, CURLOPT_XFERINFODATA, transfer);
+    curl_easy_setopt(transfer->easy, CURLOPT_XFERINFOFUNCTION, &har_events_progress_callback);
+    curl_easy_setopt(transfer->easy, CURLOPT_NOPROGRESS, 0L);
+  }
+
+  return HAR_OK;
+}
+
+/*
+ * har_transfer_done:
+ *
+ * Everything that needs the curl_easy handle is done
+ * here, on the network stage, and the rest is left
+ * to the post-processing stage.
+ */
+int
+har_transfer_done(HarTransfer * transfer, CURLcode ret)
+{
+  int status;
+  GTimeVal ended;
+  json_t * entry = transfer->entry;
+  char error[1024];
+  HarPhaseClock clock;
+
+  if (ret != CURLE_OK) {
+    har_strerror(ret, error, sizeof(error));
+    fprintf(stderr, "something happend during perform of the curl_easy handle\n%s\n", error);
+  }
+  transfer->status = (int)ret;
+  transfer->performed = TRUE;
+
+  /* transform */
+  har_phase_begin(&clock, HAR_PHASE_GETINFO, transfer->index);
+  status = har_entry_from_curl_easy_getinfo(entry, transfer->easy);
+  if (transfer->emulated) {
+    har_transfer_network_timings(transfer);
+  }
+  har_phase_end(&transfer->profile, &clock, HAR_PHASE_GETINFO, transfer->index);
+  if (status != HAR_OK) {
+    har_strerror(status, error, sizeof(error));
+    fprintf(stderr, "unable to transform curl_easy handle to har_entry object\n%s\n", error);
+    transfer->status = status;
+  }
+
+  /* free curl */
+  curl_easy_cleanup(transfer->easy);
+  transfer->easy = NULL;
+  g_byte_array_free(transfer->harbodyin, TRUE);
+  transfer->harbodyin = NULL;
+
+  g_get_current_time(&ended);
+  if (global_verbose) {
+    json_object_set_new(entry, "_stoppedDateTime", json_string(g_strdup(g_time_val_to_iso8601 (&ended))));
+  }
+  json_object_set_new(entry, "startedDateTime", json_string(g_strdup(g_time_val_to_iso8601 (&transfer->started))));
+  json_object_set_new(entry, "time", json_real((1.0e3)*(double)(ended.tv_sec - transfer->started.tv_sec) + (1.0e-3)*(double)(ended.tv_usec - transfer->started.tv_usec)));
+
+  return transfer->status;
+}
+
+/*
+ * har_transfer_redirect:
+ *
+ * With --location, a redirect is followed by a new
+ * transfer for the same entry index and the next hop, so
+ * that every hop is written as its own entry, with its
+ * own headers and timings. The next request is made from
+ * the original one, the way browsers do: 303 (and 301/302
+ * after a POST) turn into a GET without a body, and
+ * credentials are not sent to another origin.
+ */
+HarTransfer *
+har_transfer_redirect(HarRun * run, HarTransfer * transfer)
+{
+  json_t * entry = transfer->entry;
+  json_t * resp = json_object_get(entry, "response");
+  const char * location = json_string_value(json_object_get(resp, "redirectURL"));
+  long status = (long)json_integer_value(json_object_get(resp, "status"));
+  const char * method;
+  const char * name;
+  gchar * from_origin;
+  gchar * to_origin;
+  gboolean same_origin;
+  gboolean drop_body;
+  json_t * req;
+  json_t * headers;
+  json_t * header;
+  json_t * next_entry;
+  HarTransfer * next;
+  int ix;
+
+  if (run->max_redirs <= 0 || !transfer->entry_template ||
+      transfer->status != HAR_OK || !location || !*location) {
+    return NULL;
+  }
+  if (status != 301 && status != 302 && status != 303 && status != 307 && status != 308) {
+    return NULL;
+  }
+  if (transfer->hop >= run->max_redirs) {
+    fprintf(stderr, "maximum (%d) redirects followed for %s\n", run->max_redirs, location);
+    return NULL;
+  }
+
+  req = json_deep_copy(json_object_get(transfer->entry_template, "request"));
+  method = json_string_value(json_object_get(req, "method"));
+  drop_body = method &&
+    ((status == 303 && g_ascii_strcasecmp(method, "HEAD")) ||
+     ((status == 301 || status == 302) && !g_ascii_strcasecmp(method, "POST")));
+  if (drop_body) {
+    json_object_set_new(req, "method", json_string("GET"));
+    json_object_del(req, "postData");
+  }
+
+  from_origin = har_url_to_origin(json_string_value(json_object_get(req, "url")), NULL, NULL);
+  to_origin = har_url_to_origin(location, NULL, NULL);
+  same_origin = from_origin && to_origin && !strcmp(from_origin, to_origin);
+  g_free(from_origin);
+  g_free(to_origin);
+
+  headers = json_object_get(req, "headers");
+  for (ix = (int)json_array_size(headers) - 1; ix >= 0; ix--) {
+    header = json_array_get(headers, ix);
+    name = json_string_value(json_object_get(header, "name"));
+    if (!name) continue;
+    switch (har_header_lookup(name, strlen(name))) {
+    case HAR_HEADER_CONTENT_TYPE:
+    case HAR_HEADER_CONTENT_LENGTH:
+      if (drop_body) json_array_remove(headers, ix);
+      break;
+    case HAR_HEADER_AUTHORIZATION:
+    case HAR_HEADER_COOKIE:
+    case HAR_HEADER_HOST:
+      if (!same_origin) json_array_remove(headers, ix);
+      break;
+    default:
+      break;
+    }
+  }
+  json_object_set_new(req, "url", json_string(location));
+  json_object_set_new(req, "queryString", json_array());
+
+  next_entry = json_object();
+  json_object_set(next_entry, "request", req);
+  if (json_object_get(entry, "pageref")) {
+    json_object_set(next_entry, "pageref", json_object_get(entry, "pageref"));
+  }
+  json_object_set_new(next_entry, "_redirectHop", json_integer(transfer->hop + 1));
+  json_object_set_new(entry, "_redirectHop", json_integer(transfer->hop));
+
+  next = har_transfer_new(transfer->index, next_entry);
+  next->entry_template = json_deep_copy(next_entry);
+  next->hop = transfer->hop + 1;
+  next->chain_time = transfer->chain_time;
+  if (transfer->attempts) {
+    next->attempts = json_array();
+    next->attempt = next->attempts_started = 1;
+  }
+  if (transfer->origin) {
+    next->origin = har_url_to_origin(location, NULL, NULL);
+  }
+  transfer->last = FALSE;
+
+  json_decref(req);
+  json_decref(next_entry);
+  return next;
+}
+
+gboolean
+har_method_is_idempotent(const char * method)
+{
+  static const char * methods[] = { "GET", "HEAD", "OPTIONS", "TRACE", "PUT", "DELETE", NULL };
+  int ix;
+
+  for (ix = 0; method && methods[ix]; ix++) {
+    if (!g_ascii_strcasecmp(method, methods[ix])) return TRUE;
+  }
+  return FALSE;
+}
+
+/*
+ * har_transfer_is_retryable:
+ *
+ * Errors before anything was sent are retried for every
+ * method, and lost connections, 5xx and 429 only for
+ * idempotent methods, which are safe to send twice.
+ */
+gboolean
+har_transfer_is_retryable(HarTransfer * transfer, CURLcode ret)
+{
+  json_t * req = json_object_get(transfer->entry, "request");
+  json_t * resp = json_object_get(transfer->entry, "response");
+  long status = (long)json_integer_value(json_object_get(resp, "status"));
+  gboolean idempotent = har_method_is_idempotent(json_string_value(json_object_get(req, "method")));
+
+  switch (ret) {
+  case CURLE_OK:
+    return idempotent && (status >= 500 || status == 429);
+  case CURLE_COULDNT_RESOLVE_HOST:
+  case CURLE_COULDNT_CONNECT:
+  case CURLE_SSL_CONNECT_ERROR:
+    return TRUE;
+  case CURLE_GOT_NOTHING:
+  case CURLE_SEND_ERROR:
+  case CURLE_RECV_ERROR:
+    return idempotent;
+  default:
+    return FALSE;
+  }
+}
+
+/*
+ * har_headers_text_lookup:
+ *
+ * Finds the value of the last header called name in the
+ * raw response headers, before they have been parsed.
+ */
+gchar *
+har_headers_text_lookup(GByteArray * bytes, const char * name)
+{
+  gsize name_len = strlen(name);
+  const char * s = (const char *)bytes->data;
+  const char * end = s + bytes->len;
+  gchar * value = NULL;
+
+  while (s < end) {
+    const char * eol = memchr(s, '\n', end - s);
+    if (!eol) eol = end;
+    if ((gsize)(eol - s) > name_len && s[name_len] == ':' &&
+        !g_ascii_strncasecmp(s, name, name_len)) {
+      g_free(value);
+      value = g_strstrip(g_strndup(s + name_len + 1, eol - s - name_len - 1));
+    }
+    s = eol + 1;
+  }
+
+  return value;
+}
+
+/*
+ * har_transfer_annotate:
+ *
+ * Adds one attempt to entry._attempts: whether it was
+ * used, retried, failed (while its hedge went on) or
+ * cancelled (because its hedge won).
+ */
+void
+har_transfer_annotate(HarTransfer * transfer, const char * result, CURLcode ret)
+{
+  json_t * attempt;
+  json_t * resp = json_object_get(transfer->entry, "response");
+  gchar * started;
+
+  if (!transfer->attempts) return;
+
+  started = g_time_val_to_iso8601(&transfer->started);
+  attempt = json_pack("{s:i,s:s,s:s,s:b}",
+                      "attempt", transfer->attempt,
+                      "result", result,
+                      "startedDateTime", started,
+                      "hedge", transfer->is_hedge);
+  if (transfer->performed) {
+    json_object_set(attempt, "time", json_object_get(transfer->entry, "time"));
+    json_object_set(attempt, "status", json_object_get(resp, "status"));
+  } else {
+    json_object_set_new(attempt, "time", json_real((1.0e-3)*(double)(g_get_monotonic_time() - transfer->performing)));
+  }
+  if (ret != CURLE_OK) {
+    json_object_set_new(attempt, "error", json_string(curl_easy_strerror(ret)));
+  }
+  if (transfer->retry > 0) {
+    json_object_set_new(attempt, "delay", json_real(transfer->delay));
+  }
+  json_array_append_new(transfer->attempts, attempt);
+  g_free(started);
+}
+
+/*
+ * har_transfer_again:
+ *
+ * Makes another attempt at the same entry (and hop),
+ * which shares the list of attempts with this one.
+ */
+HarTransfer *
+har_transfer_again(HarTransfer * transfer)
+{
+  json_t * entry = json_deep_copy(transfer->entry_template);
+  HarTransfer * again = har_transfer_new(transfer->index, entry);
+
+  again->entry_template = json_incref(transfer->entry_template);
+  again->hop = transfer->hop;
+  again->chain_time = transfer->chain_time;
+  again->attempts = json_incref(transfer->attempts);
+  again->attempt = transfer->attempts_started + 1;
+  again->attempts_started = again->attempt;
+  transfer->attempts_started = again->attempt;
+  again->retry = transfer->retry;
+  again->origin = g_strdup(transfer->origin);
+
+  json_decref(entry);
+  return again;
+}
 
-  /* transform */
-  status = har_entry_to_curl_easy_setopt(entry, easy, harbodyin, harheadout, harbodyout);
+/*
+ * har_transfer_retry:
+ *
+ * Exponential backoff with full jitter, from --retry-delay
+ * up to --retry-max-delay, unless the server asked for a
+ * longer wait with Retry-After (in seconds).
+ */
+HarTransfer *
+har_transfer_retry(HarRun * run, HarTransfer * transfer)
+{
+  HarTransfer * retry = har_transfer_again(transfer);
+  double delay = (double)run->retry_delay * (double)(1 << MIN(transfer->retry, 20));
+  gchar * retry_after = transfer->harheadout ?
+    har_headers_text_lookup(transfer->harheadout, "Retry-After") : NULL;
+
+  delay = g_random_double_range(0, MIN(delay, (double)run->retry_max_delay));
+  if (retry_after && g_ascii_isdigit(retry_after[0])) {
+    delay = MAX(delay, MIN(1.0e3 * g_ascii_strtod(retry_after, NULL), (double)run->retry_max_delay));
+  }
+  g_free(retry_after);
+
+  retry->retry = transfer->retry + 1;
+  retry->delay = delay;
+  retry->not_before = g_get_monotonic_time() + (gint64)(1.0e3 * delay);
+  return retry;
+}
+
+/*
+ * HarHedgeOrigin:
+ *
+ * With --hedge auto, an entry is hedged once it has taken
+ * longer than the p95 of the last HAR_HEDGE_SAMPLES entries
+ * to the same origin, and only once there are enough of them.
+ */
+#define HAR_HEDGE_SAMPLES 100
+#define HAR_HEDGE_SAMPLES_MIN 20
+
+typedef struct _HarHedgeOrigin {
+  GArray * samples;
+  double p95;
+} HarHedgeOrigin;
+
+void
+har_hedge_origin_free(HarHedgeOrigin * origin)
+{
+  g_array_free(origin->samples, TRUE);
+  g_free(origin);
+}
+
+void
+har_run_hedge_sample(HarRun * run, HarTransfer * transfer)
+{
+  HarHedgeOrigin * origin;
+  GArray * sorted;
+  double time;
+
+  if (run->hedge >= 0 || !transfer->origin) return;
+  if (!run->hedge_origins) {
+    run->hedge_origins = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                               (GDestroyNotify)&har_hedge_origin_free);
+  }
+  origin = g_hash_table_lookup(run->hedge_origins, transfer->origin);
+  if (!origin) {
+    origin = g_new0(HarHedgeOrigin, 1);
+    origin->samples = g_array_new(FALSE, FALSE, sizeof(double));
+    origin->p95 = -1;
+    g_hash_table_insert(run->hedge_origins, g_strdup(transfer->origin), origin);
+  }
+
+  time = json_number_value(json_object_get(transfer->entry, "time"));
+  if (origin->samples->len == HAR_HEDGE_SAMPLES) {
+    g_array_remove_index(origin->samples, 0);
+  }
+  g_array_append_val(origin->samples, time);
+  if (origin->samples->len >= HAR_HEDGE_SAMPLES_MIN) {
+    sorted = g_array_sized_new(FALSE, FALSE, sizeof(double), origin->samples->len);
+    g_array_append_vals(sorted, origin->samples->data, origin->samples->len);
+    g_array_sort(sorted, &har_compare_double);
+    origin->p95 = g_array_index(sorted, double, (guint)(0.95 * (sorted->len - 1) + 0.5));
+    g_array_free(sorted, TRUE);
+  }
+}
+
+/* milliseconds after which to hedge, or -1 */
+double
+har_run_hedge_threshold(HarRun * run, HarTransfer * transfer)
+{
+  HarHedgeOrigin * origin;
+  json_t * req;
+
+  if (!run->hedge || transfer->hedged) return -1;
+  req = json_object_get(transfer->entry, "request");
+  if (!har_method_is_idempotent(json_string_value(json_object_get(req, "method")))) return -1;
+  if (run->hedge > 0) return run->hedge;
+
+  origin = run->hedge_origins && transfer->origin ?
+    g_hash_table_lookup(run->hedge_origins, transfer->origin) : NULL;
+  return origin ? origin->p95 : -1;
+}
+
+/*
+ * har_run_start_transfer:
+ *
+ * Hands a transfer to the multi handle, on error it is
+ * left to the caller.
+ */
+int
+har_run_start_transfer(HarRun * run, CURLM * multi, HarTransfer * transfer, GList ** running)
+{
+  int status = har_transfer_start(run, transfer);
   if (status != HAR_OK) {
-    char error[1024];
-    har_strerror(status, error, sizeof(error));
-    fprintf(stderr, "unable to transform har_entry object to curl_easy handle: %s\n", error);
     return status;
   }
 
-  /* perform */
-  ret = curl_easy_perform(easy);
-  if (ret != CURLE_OK) {
-    har_strerror(ret, error, sizeof(error));
-    fprintf(stderr, "something happend during perform of the curl_easy handle\n%s\n", error);
+  transfer->performing = g_get_monotonic_time();
+  har_phase_begin(&transfer->perform, HAR_PHASE_PERFORM, transfer->index);
+  curl_multi_add_handle(multi, transfer->easy);
+  *running = g_list_prepend(*running, transfer);
+  har_scheduler_active(run->scheduler, transfer->origin, 1);
+  return HAR_OK;
+}
+
+/*
+ * har_run_hedge:
+ *
+ * Starts a second attempt for every running entry that
+ * has taken longer than the hedge threshold, even when
+ * --parallel transfers are running already, and returns
+ * how many, which count against --parallel from then on.
+ */
+int
+har_run_hedge(HarRun * run, CURLM * multi, GList ** running)
+{
+  GList * item;
+  GPtrArray * late = g_ptr_array_new();
+  gint64 now = g_get_monotonic_time();
+  HarTransfer * transfer;
+  HarTransfer * hedge;
+  double threshold;
+  int started = 0;
+  int ix;
+
+  for (item = *running; item; item = item->next) {
+    transfer = (HarTransfer *)item->data;
+    threshold = har_run_hedge_threshold(run, transfer);
+    if (threshold >= 0 && now - transfer->performing >= (gint64)(1.0e3 * threshold)) {
+      g_ptr_array_add(late, transfer);
+    }
+  }
+
+  for (ix = 0; ix < late->len; ix++) {
+    transfer = g_ptr_array_index(late, ix);
+    hedge = har_transfer_again(transfer);
+    hedge->is_hedge = TRUE;
+    hedge->hedged = TRUE;
+    transfer->hedged = TRUE;
+    if (har_run_start_transfer(run, multi, hedge, running) != HAR_OK) {
+      har_transfer_free(hedge);
+      continue;
+    }
+    hedge->first_started = transfer->started;
+    hedge->sibling = transfer;
+    transfer->sibling = hedge;
+    started++;
+  }
+
+  g_ptr_array_free(late, TRUE);
+  return started;
+}
+
+/* cancels the other one of a hedged pair, which is left to the caller to count */
+void
+har_run_cancel_sibling(HarRun * run, CURLM * multi, GList ** running, HarTransfer * transfer)
+{
+  HarTransfer * sibling = transfer->sibling;
+
+  curl_multi_remove_handle(multi, sibling->easy);
+  *running = g_list_remove(*running, sibling);
+  har_scheduler_active(run->scheduler, sibling->origin, -1);
+  har_transfer_annotate(sibling, "cancelled", CURLE_OK);
+  har_transfer_free(sibling);
+  transfer->sibling = NULL;
+}
+
+/*
+ * har_run_settle_hedges:
+ *
+ * The first of a hedged pair to receive a response is
+ * used, so the other one is cancelled as soon as that
+ * happens, rather than when the first one has finished.
+ * Returns how many were cancelled.
+ */
+int
+har_run_settle_hedges(HarRun * run, CURLM * multi, GList ** running)
+{
+  GList * item;
+  GPtrArray * won = g_ptr_array_new();
+  HarTransfer * transfer;
+  HarTransfer * sibling;
+  int cancelled = 0;
+  int ix;
+
+  for (item = *running; item; item = item->next) {
+    transfer = (HarTransfer *)item->data;
+    sibling = transfer->sibling;
+    if (!sibling || !transfer->responded) continue;
+    if (!sibling->responded || sibling->responded > transfer->responded ||
+        (sibling->responded == transfer->responded && !transfer->is_hedge)) {
+      g_ptr_array_add(won, transfer);
+    }
+  }
+
+  for (ix = 0; ix < won->len; ix++) {
+    har_run_cancel_sibling(run, multi, running, g_ptr_array_index(won, ix));
+    cancelled++;
+  }
+
+  g_ptr_array_free(won, TRUE);
+  return cancelled;
+}
+
+/*
+ * har_transfer_hedge_used:
+ *
+ * A hedge that is used stands for its entry from the
+ * start of the first attempt: the time it was started
+ * later is added to "time", and to "blocked", since
+ * that is when the entry was waiting for it.
+ */
+void
+har_transfer_hedge_used(HarTransfer * transfer)
+{
+  json_t * timings = json_object_get(transfer->entry, "timings");
+  double blocked = json_number_value(json_object_get(timings, "blocked"));
+  double waited = (1.0e3)*(double)(transfer->started.tv_sec - transfer->first_started.tv_sec) +
+    (1.0e-3)*(double)(transfer->started.tv_usec - transfer->first_started.tv_usec);
+  gchar * started = g_time_val_to_iso8601(&transfer->first_started);
+
+  json_object_set_new(transfer->entry, "startedDateTime", json_string(started));
+  json_object_set_new(transfer->entry, "time",
+                      json_real(json_number_value(json_object_get(transfer->entry, "time")) + waited));
+  if (timings) {
+    json_object_set_new(timings, "blocked", json_real(MAX(blocked, 0) + waited));
+  }
+  g_free(started);
+}
+
+/* how long the network stage may sleep, in milliseconds */
+long
+har_run_poll_timeout(HarRun * run, GList * running, GQueue * retrying, gboolean can_start)
+{
+  gint64 now = g_get_monotonic_time();
+  gint64 wake = now + 1000000;
+  GList * item;
+  HarTransfer * transfer;
+  double threshold;
+
+  for (item = can_start ? retrying->head : NULL; item; item = item->next) {
+    transfer = (HarTransfer *)item->data;
+    wake = MIN(wake, transfer->not_before);
+  }
+  for (item = running; item; item = item->next) {
+    transfer = (HarTransfer *)item->data;
+    threshold = run->hedge ? har_run_hedge_threshold(run, transfer) : -1;
+    if (threshold >= 0) {
+      wake = MIN(wake, transfer->performing + (gint64)(1.0e3 * threshold));
+    }
+    if (transfer->resume) {
+      wake = MIN(wake, transfer->resume);
+    }
+  }
+
+  return (long)MAX(0, (wake - now + 999) / 1000);
+}
+
+/* resumes the transfers whose emulated latency or pacing is over */
+void
+har_run_resume(GList * running, gint64 now)
+{
+  GList * item;
+  HarTransfer * transfer;
+
+  for (item = running; item; item = item->next) {
+    transfer = (HarTransfer *)item->data;
+    if (!transfer->resume || transfer->resume > now) continue;
+    if (transfer->paused) {
+      transfer->added_latency = (1.0e-3)*(double)(now - transfer->paused);
+      transfer->paused = 0;
+    }
+    transfer->resume = 0;
+    curl_easy_pause(transfer->easy, CURLPAUSE_CONT);
+  }
+}
+
+HarTransfer *
+har_queue_pop_due(GQueue * queue, gint64 now)
+{
+  GList * item;
+  HarTransfer * transfer;
+
+  for (item = queue->head; item; item = item->next) {
+    transfer = (HarTransfer *)item->data;
+    if (transfer->not_before <= now) {
+      g_queue_delete_link(queue, item);
+      return transfer;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * har_run_perform:
+ *
+ * The network stage. Keeps up to pipeline->parallel
+ * transfers going, and hands every finished one over
+ * to the post-processing stage. Entries are taken out
+ * of the array as they are started, so that memory is
+ * released as soon as the writer is done with them.
+ * Retries that are due go first, then redirects, then
+ * new entries, in the order of the scheduler.
+ */
+int
+har_run_perform(HarRun * run, json_t * entries, HarPipeline * pipeline)
+{
+  int ret = HAR_OK;
+  int status;
+  int next;
+  int active = 0;
+  int running = 0;
+  int left;
+  double queue_time;
+  gchar * origin;
+  gboolean failed;
+  gboolean finished;
+  CURLcode result;
+  CURLM * multi = curl_multi_init();
+  CURLMsg * msg;
+  HarTransfer * transfer;
+  HarTransfer * hop;
+  HarTransfer * sibling;
+  GQueue * redirects = g_queue_new();
+  GQueue * retrying = g_queue_new();
+  GList * transfers = NULL;
+  HarScheduler scheduler;
+
+  if (!multi) {
+    fprintf(stderr, "no curl_multi handle\n");
+    return HAR_ERROR_WITH_CURL;
+  }
+  if (run->max_host_connections > 0) {
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)run->max_host_connections);
+  }
+  har_scheduler_init(&scheduler, entries, pipeline->first,
+                     run->max_host_connections, run->rate, run->burst, run->pairs);
+  run->scheduler = &scheduler;
+
+  while (scheduler.remaining > 0 || active > 0 ||
+         !g_queue_is_empty(redirects) || !g_queue_is_empty(retrying)) {
+    gint64 started = g_get_monotonic_time();
+
+    while (active < pipeline->parallel) {
+      /* the second entry of a concurrent pair starts right after the first one */
+      if (!scheduler.partner && (transfer = har_queue_pop_due(retrying, started))) {
+      } else if (!scheduler.partner && !g_queue_is_empty(redirects)) {
+        transfer = (HarTransfer *)g_queue_pop_head(redirects);
+      } else if ((next = har_scheduler_next(&scheduler, started, pipeline->parallel - active,
+                                                &origin, &queue_time)) >= 0) {
+        transfer = har_transfer_new(next, json_array_get(entries, next));
+        json_array_set_new(entries, next, json_null());
+        transfer->origin = origin;
+        if (scheduler.fair) {
+          json_object_set_new(transfer->entry, "_queueTime", json_real(queue_time));
+        }
+        if (run->max_redirs > 0 || run->retries > 0 || run->hedge) {
+          transfer->entry_template = json_deep_copy(transfer->entry);
+        }
+        if (run->retries > 0 || run->hedge) {
+          json_t * req = json_object_get(transfer->entry, "request");
+          transfer->attempts = json_array();
+          transfer->attempt = transfer->attempts_started = 1;
+          if (!transfer->origin) {
+            transfer->origin = har_url_to_origin(json_string_value(json_object_get(req, "url")), NULL, NULL);
+          }
+        }
+      } else {
+        break;
+      }
+
+      status = har_run_start_transfer(run, multi, transfer, &transfers);
+      if (status != HAR_OK) {
+        transfer->status = status;
+        if (ret == HAR_OK) ret = status;
+        har_pipeline_push(pipeline, transfer);
+        continue;
+      }
+      active++;
+    }
+
+    if (run->hedge) {
+      active += har_run_hedge(run, multi, &transfers);
+    }
+
+    har_run_resume(transfers, g_get_monotonic_time());
+    curl_multi_perform(multi, &running);
+    if (run->hedge) {
+      active -= har_run_settle_hedges(run, multi, &transfers);
+    }
+    finished = FALSE;
+    while ((msg = curl_multi_info_read(multi, &left))) {
+      if (msg->msg != CURLMSG_DONE) continue;
+      finished = TRUE;
+      result = msg->data.result;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&transfer);
+      curl_multi_remove_handle(multi, msg->easy_handle);
+      har_phase_end(&transfer->profile, &transfer->perform, HAR_PHASE_PERFORM, transfer->index);
+      transfers = g_list_remove(transfers, transfer);
+      har_scheduler_active(&scheduler, transfer->origin, -1);
+      active--;
+
+      status = har_transfer_done(transfer, result);
+      failed = har_transfer_is_retryable(transfer, result);
+      sibling = transfer->sibling;
+
+      /* the other one of a hedged pair may still make it */
+      if (failed && sibling) {
+        har_transfer_annotate(transfer, "failed", result);
+        sibling->sibling = NULL;
+        har_transfer_free(transfer);
+        continue;
+      }
+      if (failed && transfer->retry < run->retries) {
+        har_transfer_annotate(transfer, "retried", result);
+        g_queue_push_tail(retrying, har_transfer_retry(run, transfer));
+        har_transfer_free(transfer);
+        continue;
+      }
+      /* neither had a response yet, and this one is used as it finished */
+      if (sibling) {
+        har_run_cancel_sibling(run, multi, &transfers, transfer);
+        active--;
+      }
+      if (transfer->attempts) {
+        har_transfer_annotate(transfer, "used", result);
+        json_object_set(transfer->entry, "_attempts", transfer->attempts);
+        if (transfer->is_hedge) {
+          har_transfer_hedge_used(transfer);
+        }
+        if (!failed && result == CURLE_OK) {
+          har_run_hedge_sample(run, transfer);
+        }
+      }
+      if (status != HAR_OK && ret == HAR_OK) ret = status;
+      har_scheduler_done(&scheduler, transfer->origin,
+                         json_number_value(json_object_get(transfer->entry, "time")));
+
+      transfer->chain_time += json_number_value(json_object_get(transfer->entry, "time"));
+      hop = har_transfer_redirect(run, transfer);
+      if (hop) {
+        g_queue_push_tail(redirects, hop);
+      } else if (transfer->hop > 0) {
+        json_object_set_new(transfer->entry, "_redirectChain",
+                            json_pack("{s:i,s:f,s:f}",
+                                      "hops", transfer->hop,
+                                      "time", transfer->chain_time,
+                                      "redirectTime", transfer->chain_time -
+                                      json_number_value(json_object_get(transfer->entry, "time"))));
+      }
+      har_pipeline_push(pipeline, transfer);
+    }
+
+    g_mutex_lock(&pipeline->lock);
+    pipeline->network_busy += g_get_monotonic_time() - started;
+    g_mutex_unlock(&pipeline->lock);
+
+    /* when a transfer finished, its slot is filled before sleeping */
+    if (!finished && g_queue_is_empty(redirects) &&
+        (active > 0 || !g_queue_is_empty(retrying) || scheduler.remaining > 0)) {
+      long timeout = har_run_poll_timeout(run, transfers, retrying, active < pipeline->parallel);
+      if (active < pipeline->parallel) {
+        gint64 now = g_get_monotonic_time();
+        timeout = MIN(timeout, (long)MAX(0, (MIN(har_scheduler_wake(&scheduler, now), now + 1000000) - now + 999) / 1000));
+      }
+      curl_multi_poll(multi, NULL, 0, timeout, NULL);
+    }
+  }
+
+  if (scheduler.fair) {
+    run->scheduler_stats = har_scheduler_to_json(&scheduler);
+  }
+  run->scheduler = NULL;
+  har_scheduler_clear(&scheduler);
+  g_list_free(transfers);
+  g_queue_free(redirects);
+  g_queue_free(retrying);
+  curl_multi_cleanup(multi);
+  return ret;
+}
+
+/*
+ * har_log_write_head/tail:
+ *
+ * The entries of a HAR log are written one at a time
+ * by the writer stage, in between these two.
+ */
+void
+har_log_write_head(FILE * stream)
+{
+  fputs("{\n\"log\": {\n\"entries\": [\n", stream);
+}
+
+void
+har_log_write_tail(FILE * stream, json_t * log)
+{
+  int ix;
+  const char * key;
+  json_t * value;
+  GPtrArray * keys = g_ptr_array_new();
+
+  json_object_foreach(log, key, value) {
+    if (strcmp(key, "entries")) {
+      g_ptr_array_add(keys, (gpointer)key);
+    }
   }
+  g_ptr_array_sort(keys, (GCompareFunc)&har_strcmp_indirect);
+
+  fputs("\n]", stream);
+  for (ix = 0; ix < keys->len; ix++) {
+    json_t * name = json_string(g_ptr_array_index(keys, ix));
+    fputs(",\n", stream);
+    json_dumpf(name, stream, JSON_ENCODE_ANY);
+    fputs(": ", stream);
+    json_dumpf(json_object_get(log, g_ptr_array_index(keys, ix)), stream,
+               JSON_SORT_KEYS | JSON_INDENT(2) | JSON_ENCODE_ANY);
+    json_decref(name);
+  }
+  fputs("\n}\n}\n", stream);
+  fflush(stream);
+
+  g_ptr_array_free(keys, TRUE);
+}
+
+#ifndef HARCURL_NO_MAIN
+int
+main(int argc, char *argv[])
+{
+  int ret = HAR_OK;
+  int status;
+  int parallel = 1;
+  int workers = 0;
+  gboolean location = FALSE;
+  int max_redirs = 20;
+  int retries = 0;
+  int retry_delay = 100;
+  int retry_max_delay = 10000;
+  gchar * hedge = NULL;
+  int max_host_connections = 0;
+  double rate = 0;
+  int burst = 1;
+  gchar * network = NULL;
+  int events_interval = 1000;
+  gchar ** compare_targets = NULL;
+  gchar * compare_mode = NULL;
+  HarCompare compare;
+  gchar * capture_file = NULL;
+  gchar * capture_compression = NULL;
+  int capture_block_size = 1024;
+  HarCaptureCodec capture_codec = HAR_CAPTURE_NONE;
+  HarCapture capture;
+  gchar * output_file = NULL;
+  gchar * journal_file = NULL;
+  gboolean resume = FALSE;
+  gboolean resumed_done = FALSE;
+  int checkpoint = 100;
+  int first = 0;
+  long offset = 0;
+  long journal_length = 0;
+  FILE * output = NULL;
+  HarJournal journal;
+  size_t flags;
+  json_t * root;
+  json_t * log;
+  json_t * entries;
+  json_t * stats;
+  json_error_t parse_error;
+  GError * option_error = NULL;
+  GOptionContext * options;
+  HarRun run;
+  HarPipeline pipeline;
+  HarProfile profile;
+  HarPhaseClock clock;
+  struct timespec cpu;
+  gint64 started = g_get_monotonic_time();
+  HarWarmupMode warmup_mode = HAR_WARMUP_NONE;
+  gchar * warmup = NULL;
+  gchar * resolve_file = NULL;
+  gchar * cacert = NULL;
+
+  GOptionEntry option_entries[] = {
+    { "verbose", 'v', 0, G_OPTION_ARG_NONE, &global_verbose,
+      "Add nonstandard HAR properties", NULL },
+    { "warmup", 'w', 0, G_OPTION_ARG_STRING, &warmup,
+      "Resolve (dns), connect to (connect) or send HEAD to (head) every origin before the first entry", "MODE" },
+    { "resolve", 0, 0, G_OPTION_ARG_FILENAME, &resolve_file,
+      "Read host:port:address pins from FILE", "FILE" },
+    { "cacert", 0, 0, G_OPTION_ARG_FILENAME, &cacert,
+      "Verify peers with the CA certificates in FILE", "FILE" },
+    { "tls-session-cache", 0, 0, G_OPTION_ARG_FILENAME, &global_tls_session_cache,
+      "Resume TLS sessions saved in FILE by previous runs, and save them again at exit", "FILE" },
+    { "parallel", 'p', 0, G_OPTION_ARG_INT, &parallel,
+      "Keep up to N transfers going at the same time (default 1)", "N" },
+    { "workers", 0, 0, G_OPTION_ARG_INT, &workers,
+      "Decode and serialize responses on N threads (default: one per CPU)", "N" },
+    { "location", 'L', 0, G_OPTION_ARG_NONE, &location,
+      "Follow redirects, and write every hop as its own entry", NULL },
+    { "max-redirs", 0, 0, G_OPTION_ARG_INT, &max_redirs,
+      "Follow up to N redirects per entry with --location (default 20)", "N" },
+    { "retries", 0, 0, G_OPTION_ARG_INT, &retries,
+      "Retry up to N times after connect errors, and 5xx or 429 for idempotent methods (default 0)", "N" },
+    { "retry-delay", 0, 0, G_OPTION_ARG_INT, &retry_delay,
+      "Back off from MS milliseconds, doubling with every retry (default 100)", "MS" },
+    { "retry-max-delay", 0, 0, G_OPTION_ARG_INT, &retry_max_delay,
+      "Never back off longer than MS milliseconds (default 10000)", "MS" },
+    { "hedge", 0, 0, G_OPTION_ARG_STRING, &hedge,
+      "Send idempotent requests again when they take longer than MS, or than the p95 of the origin (auto)", "MS|auto" },
+    { "max-host-connections", 0, 0, G_OPTION_ARG_INT, &max_host_connections,
+      "Keep up to N transfers going to every origin, and take turns between origins", "N" },
+    { "rate", 0, 0, G_OPTION_ARG_DOUBLE, &rate,
+      "Start up to RPS entries per second to every origin, and take turns between origins", "RPS" },
+    { "burst", 0, 0, G_OPTION_ARG_INT, &burst,
+      "Let every origin save up to N entries of --rate (default 1)", "N" },
+    { "network", 0, 0, G_OPTION_ARG_STRING, &network,
+      "Emulate a slow network: a preset (2g, 3g-slow, 3g, 3g-fast, 4g, lte, dsl, cable, fios), "
+      "and/or downloadKbps, uploadKbps, latency, connectLatency and receiveBuffer", "PRESET[,KEY=VALUE...]" },
+    { "compare", 0, 0, G_OPTION_ARG_STRING_ARRAY, &compare_targets,
+      "Send every entry to two targets (given twice, A then B), with the origin of the URL rewritten, and compare them", "URL" },
+    { "compare-mode", 0, 0, G_OPTION_ARG_STRING, &compare_mode,
+      "Send the two entries of a pair one after the other (interleaved, the default), or at the same time (concurrent)", "MODE" },
+    { "events", 0, 0, G_OPTION_ARG_NONE, &global_events,
+      "Write events (request_sent, headers_received, progress, complete) to stdout as they happen, one JSON object per line, instead of HAR", NULL },
+    { "events-interval", 0, 0, G_OPTION_ARG_INT, &events_interval,
+      "Write a progress event for every transfer every MS milliseconds with --events (default 1000)", "MS" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_file,
+      "Write HAR to FILE instead of stdout, and journal the entries of a log in FILE.journal", "FILE" },
+    { "resume", 0, 0, G_OPTION_ARG_NONE, &resume,
+      "Skip the entries that FILE.journal says are in -o FILE already, and append the others", NULL },
+    { "checkpoint", 0, 0, G_OPTION_ARG_INT, &checkpoint,
+      "Sync -o FILE and its journal every N entries, or every second (default 100)", "N" },
+    { "capture", 0, 0, G_OPTION_ARG_FILENAME, &capture_file,
+      "Append entries to FILE in the binary capture format, instead of writing HAR (see harcurl convert)", "FILE" },
+    { "capture-compression", 0, 0, G_OPTION_ARG_STRING, &capture_compression,
+      "Compress the blocks of --capture with none (the default), gzip or zstd", "CODEC" },
+    { "capture-block-size", 0, 0, G_OPTION_ARG_INT, &capture_block_size,
+      "Write a block of --capture every KB kilobytes of entries (default 1024)", "KB" },
+    { "profile", 0, 0, G_OPTION_ARG_NONE, &global_profile,
+      "Time the internal phases of every entry (_harcurlTimings)", NULL },
+    NULL
+  };
   
-  /* transform */
-  status = har_entry_from_curl_easy_getinfo(entry, easy, harheadout, harbodyout);
-  if (status != HAR_OK) {
-    har_strerror(status, error, sizeof(error));
-    fprintf(stderr, "unable to transform curl_easy handle to har_entry object\n%s\n", error);
-    return status;
+  /* harcurl convert [--ndjson] [--entry N] FILE */
+  if (argc > 1 && !strcmp(argv[1], "convert")) {
+    return har_capture_convert_main(argc - 1, argv + 1);
   }
 
-  /* free curl */
-  curl_easy_cleanup(easy);
-  easy = NULL;
+  /* parse args */
+  options = g_option_context_new("harcurl (" PACKAGE_VERSION ")");
+  g_option_context_add_main_entries(options, option_entries, NULL);
+  if (g_option_context_parse(options, &argc, &argv, &option_error) != TRUE) {
+    fprintf(stderr, "error parsing options\n");
+  }
+  if (warmup) {
+    if (!g_ascii_strcasecmp(warmup, "dns")) {
+      warmup_mode = HAR_WARMUP_DNS;
+    } else if (!g_ascii_strcasecmp(warmup, "connect")) {
+      warmup_mode = HAR_WARMUP_CONNECT;
+    } else if (!g_ascii_strcasecmp(warmup, "head")) {
+      warmup_mode = HAR_WARMUP_HEAD;
+    } else {
+      fprintf(stderr, "unknown warmup mode %s\n", warmup);
+      return HAR_ERROR_UNKNOWN;
+    }
+  }
+  if (output_file && (global_events || capture_file)) {
+    fprintf(stderr, "-o cannot be used with --events or --capture\n");
+    return HAR_ERROR_UNKNOWN;
+  }
+  if (resume && !output_file) {
+    fprintf(stderr, "--resume needs -o FILE\n");
+    return HAR_ERROR_UNKNOWN;
+  }
+  if (capture_file) {
+    if (global_events) {
+      fprintf(stderr, "--capture and --events cannot be used together\n");
+      return HAR_ERROR_UNKNOWN;
+    }
+    if (capture_compression &&
+        (status = har_capture_codec_from_name(capture_compression, &capture_codec)) != HAR_OK) {
+      return status;
+    }
+    global_capture = TRUE;
+  }
+  if (compare_targets) {
+    if (g_strv_length(compare_targets) != 2) {
+      fprintf(stderr, "--compare must be given twice, for target A and for target B\n");
+      return HAR_ERROR_UNKNOWN;
+    }
+    if (compare_mode && !g_ascii_strcasecmp(compare_mode, "concurrent")) {
+      har_compare_init(&compare, compare_targets[0], compare_targets[1], HAR_COMPARE_CONCURRENT);
+      parallel = MAX(parallel, 2);
+    } else if (!compare_mode || !g_ascii_strcasecmp(compare_mode, "interleaved")) {
+      har_compare_init(&compare, compare_targets[0], compare_targets[1], HAR_COMPARE_INTERLEAVED);
+    } else {
+      fprintf(stderr, "unknown compare mode %s\n", compare_mode);
+      return HAR_ERROR_UNKNOWN;
+    }
+  }
+  
+  /* load json */
+  flags = 0;
+  memset(&profile, 0, sizeof(profile));
+  har_phase_begin(&clock, HAR_PHASE_LOAD, -1);
+  root = json_loadf(stdin, flags, &parse_error);
+  har_phase_end(&profile, &clock, HAR_PHASE_LOAD, -1);
+  if (!root) {
+    fprintf(stderr, "no JSON could be decoded on standard input\n");
+    return HAR_ERROR_WITH_JSON;
+  }
 
-  /* dump json */
-  g_get_current_time(&ended);
-  if (global_verbose) {
-    json_object_set_new(entry, "_stoppedDateTime", json_string(g_strdup(g_time_val_to_iso8601 (&ended))));
+  /* the hops of a single entry, the two entries of a pair, or the totals of --profile, can only be written as a HAR log */
+  if ((location || compare_targets || global_profile) && !json_object_get(root, "log")) {
+    root = json_pack("{s:{s:s,s:{s:s,s:s},s:[o]}}", "log",
+                     "version", "1.2",
+                     "creator", "name", PACKAGE_NAME, "version", PACKAGE_VERSION,
+                     "entries", root);
   }
-  json_object_set_new(entry, "startedDateTime", json_string(g_strdup(g_time_val_to_iso8601 (&started))));
-  json_object_set_new(entry, "time", json_real((1.0e3)*(double)(ended.tv_sec - started.tv_sec) + (1.0e-3)*(double)(ended.tv_usec - started.tv_usec)));
-  flags = JSON_SORT_KEYS | JSON_INDENT(2);
-  status = json_dumpf(entry, stdout, flags);
-  if (status) {
-    fprintf(stderr, "something happend during dump of the har_entry object\n");
+
+  /* either a whole HAR log, or a single entry */
+  log = json_object_get(root, "log");
+  if (log && json_is_object(log)) {
+    entries = json_object_get(log, "entries");
+    if (!entries || !json_is_array(entries)) {
+      fprintf(stderr, "The log has no entries\n");
+      return HAR_ERROR_NO_REQUEST;
+    }
+    json_incref(entries);
+  } else {
+    log = NULL;
+    entries = json_array();
+    json_array_append(entries, root);
+    if (!json_is_object(json_object_get(root, "request"))) {
+      fprintf(stderr, "The request is missing\n");
+      return HAR_ERROR_NO_REQUEST;
+    }
+  }
+
+  if (compare_targets) {
+    json_t * expanded = har_compare_expand(&compare, entries);
+    json_object_set(log, "entries", expanded);
+    json_decref(entries);
+    entries = expanded;
+  }
+
+  /* only a HAR log has a journal, since a single entry has nothing to resume */
+  if (output_file) {
+    journal_file = g_strconcat(output_file, ".journal", NULL);
+    if (resume && log) {
+      status = har_journal_read(journal_file, output_file, entries, &first, &offset,
+                                &journal_length, &resumed_done);
+      if (status != HAR_OK) {
+        return status;
+      }
+      if (resumed_done) {
+        fprintf(stderr, "%s is complete already\n", output_file);
+        return HAR_OK;
+      }
+    }
+    output = fopen(output_file, first > 0 ? "r+b" : "wb");
+    if (!output) {
+      fprintf(stderr, "unable to open %s\n", output_file);
+      return HAR_ERROR_UNKNOWN;
+    }
+    if (first > 0) {
+      if (ftruncate(fileno(output), offset) != 0) {
+        fprintf(stderr, "unable to truncate %s\n", output_file);
+        return HAR_ERROR_RESUME;
+      }
+      fseek(output, offset, SEEK_SET);
+      fprintf(stderr, "resuming %s after %d of %d entries\n", output_file, first, (int)json_array_size(entries));
+    }
+    if (log) {
+      status = har_journal_open(&journal, journal_file, output, entries, checkpoint,
+                                first > 0 ? journal_length : 0);
+      if (status != HAR_OK) {
+        return status;
+      }
+    }
+    if (first > 0) {
+      json_t * rest = json_array();
+      int ix;
+      for (ix = first; ix < (int)json_array_size(entries); ix++) {
+        json_array_append(rest, json_array_get(entries, ix));
+      }
+      json_decref(entries);
+      entries = rest;
+    }
+  }
+
+  status = har_run_init(&run);
+  if (status != HAR_OK) {
+    fprintf(stderr, "no curl_share handle\n");
     return status;
   }
+  run.cacert = cacert;
+  if (location) {
+    run.max_redirs = CLAMP(max_redirs, 0, HAR_REDIRECT_HOPS_MAX - 1);
+  }
+  run.pairs = compare_targets && compare.mode == HAR_COMPARE_CONCURRENT;
+  run.max_host_connections = MAX(max_host_connections, 0);
+  run.rate = MAX(rate, 0);
+  run.burst = MAX(burst, 1);
+  run.retries = MAX(retries, 0);
+  run.retry_delay = MAX(retry_delay, 0);
+  run.retry_max_delay = MAX(retry_max_delay, run.retry_delay);
+  if (hedge) {
+    if (!g_ascii_strcasecmp(hedge, "auto")) {
+      run.hedge = -1;
+    } else if ((run.hedge = atoi(hedge)) <= 0) {
+      fprintf(stderr, "--hedge takes a number of milliseconds, or auto\n");
+      return HAR_ERROR_UNKNOWN;
+    }
+  }
+  if (network) {
+    status = har_network_parse(&run.network, network);
+    if (status != HAR_OK) {
+      return status;
+    }
+  }
+  if (resolve_file) {
+    status = har_resolve_from_file(resolve_file, &run.resolve);
+    if (status != HAR_OK) {
+      return status;
+    }
+  }
+  if (global_tls_session_cache) {
+#ifdef HAVE_OPENSSL
+    har_tls_session_cache_load(global_tls_session_cache);
+#else
+    fprintf(stderr, "--tls-session-cache needs harcurl to be built with OpenSSL\n");
+#endif
+  }
+  if (warmup_mode != HAR_WARMUP_NONE) {
+    har_run_warmup(&run, entries, warmup_mode, parallel);
+    json_object_set_new(run.warmup, "mode", json_string(warmup));
+    json_object_set((log ? log : root), "_warmup", run.warmup);
+  }
+
+  /* perform, and dump json as we go */
+  status = har_pipeline_init(&pipeline, (int)json_array_size(entries), parallel, workers, log != NULL);
+  if (status != HAR_OK) {
+    return status;
+  }
+  if (compare_targets) {
+    pipeline.compare = &compare;
+  }
+  if (output) {
+    pipeline.stream = output;
+    pipeline.first = first;
+    if (log) {
+      pipeline.journal = &journal;
+    }
+  }
+  if (capture_file) {
+    status = har_capture_open(&capture, capture_file, capture_codec, (gsize)MAX(capture_block_size, 1) * 1024);
+    if (status != HAR_OK) {
+      return status;
+    }
+    pipeline.capture = &capture;
+  }
+  global_events_started = started;
+  global_events_interval = MAX(events_interval, 1);
+  if (log && !global_events && !capture_file && first == 0) {
+    har_log_write_head(pipeline.stream);
+  }
+  ret = har_run_perform(&run, entries, &pipeline);
+  stats = har_pipeline_finish(&pipeline);
+  if (log) {
+    json_object_set_new(log, "_pipeline", stats);
+    if (run.scheduler_stats) {
+      json_object_set(log, "_scheduler", run.scheduler_stats);
+    }
+    if (compare_targets) {
+      json_object_set_new(log, "_compare", har_compare_to_json(&compare));
+      har_compare_clear(&compare);
+    }
+    if (global_profile) {
+      har_profile_add(&profile, &pipeline.profile);
+      json_object_set_new(log, "_harcurlTimings", har_profile_to_json(&profile, TRUE));
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+      json_object_set_new(json_object_get(log, "_harcurlTimings"), "total",
+                          json_pack("{s:f,s:f}",
+                                    "wall", (1.0e-3)*(double)(g_get_monotonic_time() - started),
+                                    "cpu", (1.0e3)*(double)cpu.tv_sec + (1.0e-6)*(double)cpu.tv_nsec));
+    }
+    if (global_events) {
+      json_object_del(log, "entries");
+      har_events_emit("done", NULL, json_pack("{s:O}", "log", log), NULL);
+    } else if (capture_file) {
+      status = har_capture_close(&capture, log);
+      ret = ret == HAR_OK ? status : ret;
+    } else {
+      har_log_write_tail(pipeline.stream, log);
+    }
+    if (pipeline.journal) {
+      fflush(pipeline.stream);
+      har_journal_close(&journal, ftell(pipeline.stream));
+    }
+  } else {
+    json_decref(stats);
+    if (global_events) {
+      har_events_emit("done", NULL, NULL, NULL);
+    }
+    if (capture_file) {
+      status = har_capture_close(&capture, NULL);
+      ret = ret == HAR_OK ? status : ret;
+    }
+    fflush(pipeline.stream);
+  }
+
+  har_run_cleanup(&run);
+#ifdef HAVE_OPENSSL
+  if (global_tls_sessions) {
+    har_tls_session_cache_save(global_tls_session_cache);
+  }
+#endif
 
-  return (int)ret;
+  if (output) {
+    fclose(output);
+  }
+  g_free(journal_file);
+  json_decref(entries);
+  json_decref(root);
+  har_header_pool_clear();
+  return ret;
 }
+#endif /* HARCURL_NO_MAIN */
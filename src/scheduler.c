@@ -0,0 +1,314 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+/*
+ * The per-origin queues of the network stage, for
+ * --max-host-connections, --rate and --compare-mode
+ * concurrent. See scheduler.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <jansson.h>
+
+#include "config.h"
+#include "harcurl.h"
+#include "compare.h"
+#include "scheduler.h"
+
+static HarSchedulerOrigin *
+har_scheduler_origin(HarScheduler * scheduler, const char * origin)
+{
+  HarSchedulerOrigin * item = g_hash_table_lookup(scheduler->by_origin, origin);
+  if (!item) {
+    item = g_new0(HarSchedulerOrigin, 1);
+    item->origin = g_strdup(origin);
+    g_queue_init(&item->pending);
+    item->tokens = scheduler->burst;
+    item->refilled = scheduler->started;
+    item->queue_times = g_array_new(FALSE, FALSE, sizeof(double));
+    item->network_times = g_array_new(FALSE, FALSE, sizeof(double));
+    g_hash_table_insert(scheduler->by_origin, item->origin, item);
+    g_ptr_array_add(scheduler->origins, item);
+  }
+  return item;
+}
+
+static void
+har_scheduler_origin_free(HarSchedulerOrigin * item)
+{
+  g_queue_clear(&item->pending);
+  g_array_free(item->queue_times, TRUE);
+  g_array_free(item->network_times, TRUE);
+  g_free(item->origin);
+  g_free(item);
+}
+
+/* first is the index in the input of entries[0], when resuming */
+void
+har_scheduler_init(HarScheduler * scheduler, json_t * entries, int first,
+                   int max_host_connections, double rate, int burst, gboolean pairs)
+{
+  int ix;
+  json_t * entry;
+
+  memset(scheduler, 0, sizeof(*scheduler));
+  scheduler->fair = max_host_connections > 0 || rate > 0;
+  scheduler->pairs = pairs;
+  scheduler->max_host_connections = max_host_connections;
+  scheduler->rate = rate;
+  scheduler->burst = MAX(burst, 1);
+  scheduler->started = g_get_monotonic_time();
+  scheduler->remaining = (int)json_array_size(entries);
+  scheduler->first = first;
+  scheduler->origins = g_ptr_array_new_with_free_func((GDestroyNotify)&har_scheduler_origin_free);
+  scheduler->by_origin = g_hash_table_new(g_str_hash, g_str_equal);
+
+  json_array_foreach(entries, ix, entry) {
+    gchar * origin = NULL;
+    if (scheduler->fair) {
+      json_t * req = json_object_get(entry, "request");
+      origin = har_url_to_origin(json_string_value(json_object_get(req, "url")), NULL, NULL);
+    }
+    g_queue_push_tail(&har_scheduler_origin(scheduler, origin ? origin : "")->pending,
+                      GINT_TO_POINTER(ix));
+    g_free(origin);
+  }
+}
+
+void
+har_scheduler_clear(HarScheduler * scheduler)
+{
+  g_hash_table_destroy(scheduler->by_origin);
+  g_ptr_array_free(scheduler->origins, TRUE);
+}
+
+/* adds the tokens earned since the last refill, up to --burst */
+static gboolean
+har_scheduler_origin_ready(HarScheduler * scheduler, HarSchedulerOrigin * item, gint64 now)
+{
+  if (g_queue_is_empty(&item->pending)) return FALSE;
+  if (scheduler->max_host_connections > 0 && item->active >= scheduler->max_host_connections) return FALSE;
+  if (scheduler->rate > 0) {
+    item->tokens = MIN((double)scheduler->burst,
+                       item->tokens + scheduler->rate * (1.0e-6)*(double)(now - item->refilled));
+    item->refilled = now;
+    if (item->tokens < 1) return FALSE;
+  }
+  return TRUE;
+}
+
+/* whether the entry is the second one of a pair, with --compare-mode concurrent,
+ * which goes by the index in the input, since a run may resume in the middle of a pair */
+static gboolean
+har_scheduler_is_second(HarScheduler * scheduler, int ix)
+{
+  return (scheduler->first + ix) % 2 == 1;
+}
+
+/* the origin at the head of which the entry waits, if any */
+static HarSchedulerOrigin *
+har_scheduler_head(HarScheduler * scheduler, int ix)
+{
+  guint jx;
+  HarSchedulerOrigin * item;
+
+  for (jx = 0; jx < scheduler->origins->len; jx++) {
+    item = g_ptr_array_index(scheduler->origins, jx);
+    if (!g_queue_is_empty(&item->pending) && GPOINTER_TO_INT(g_queue_peek_head(&item->pending)) == ix) {
+      return item;
+    }
+  }
+  return NULL;
+}
+
+/* the origin of the second entry of a pair, whose first one is at the head of item:
+ * right behind it in the same queue, or at the head of another one */
+static HarSchedulerOrigin *
+har_scheduler_partner(HarScheduler * scheduler, HarSchedulerOrigin * item, int ix)
+{
+  if (g_queue_get_length(&item->pending) > 1 &&
+      GPOINTER_TO_INT(g_queue_peek_nth(&item->pending, 1)) == ix) {
+    return item;
+  }
+  return har_scheduler_head(scheduler, ix);
+}
+
+/* whether the second entry of a pair can start along with the first one, from item */
+static gboolean
+har_scheduler_partner_ready(HarScheduler * scheduler, HarSchedulerOrigin * item,
+                            HarSchedulerOrigin * partner, gint64 now)
+{
+  /* the same origin has to take both, and the second token is borrowed from the next refill */
+  if (partner == item) {
+    return scheduler->max_host_connections <= 0 || item->active + 2 <= scheduler->max_host_connections;
+  }
+  return har_scheduler_origin_ready(scheduler, partner, now);
+}
+
+static int
+har_scheduler_take(HarScheduler * scheduler, HarSchedulerOrigin * item, gint64 now,
+                   gchar ** origin, double * queue_time)
+{
+  if (scheduler->rate > 0) {
+    item->tokens -= 1;
+  }
+  scheduler->remaining--;
+  *origin = scheduler->fair ? g_strdup(item->origin) : NULL;
+  *queue_time = (1.0e-3)*(double)(now - scheduler->started);
+  g_array_append_val(item->queue_times, *queue_time);
+  return GPOINTER_TO_INT(g_queue_pop_head(&item->pending));
+}
+
+/*
+ * har_scheduler_next:
+ *
+ * Returns the index of the next entry to start, or -1
+ * when every origin with entries left has to wait. With
+ * pairs, the first entry of a pair only starts when there
+ * is room for the second one too, and when the origin of
+ * the second one is ready as well, which is then returned
+ * by the next call, so that both start together.
+ */
+int
+har_scheduler_next(HarScheduler * scheduler, gint64 now, int room, gchar ** origin, double * queue_time)
+{
+  guint ix;
+  guint len = scheduler->origins->len;
+  int head;
+  HarSchedulerOrigin * item;
+  HarSchedulerOrigin * partner;
+
+  if (scheduler->partner) {
+    item = scheduler->partner;
+    scheduler->partner = NULL;
+    return har_scheduler_take(scheduler, item, now, origin, queue_time);
+  }
+
+  for (ix = 0; ix < len; ix++) {
+    item = g_ptr_array_index(scheduler->origins, (scheduler->cursor + ix) % len);
+    if (!har_scheduler_origin_ready(scheduler, item, now)) continue;
+
+    partner = NULL;
+    if (scheduler->pairs) {
+      head = GPOINTER_TO_INT(g_queue_peek_head(&item->pending));
+      /* a second entry goes with its first one, unless that one is not waiting anymore */
+      if (har_scheduler_is_second(scheduler, head)) {
+        if (har_scheduler_head(scheduler, head - 1)) continue;
+      } else if ((partner = har_scheduler_partner(scheduler, item, head + 1))) {
+        if (room < 2 || !har_scheduler_partner_ready(scheduler, item, partner, now)) continue;
+      }
+    }
+
+    scheduler->cursor = (scheduler->cursor + ix + 1) % len;
+    scheduler->partner = partner;
+    return har_scheduler_take(scheduler, item, now, origin, queue_time);
+  }
+
+  return -1;
+}
+
+/* when the next token of a waiting origin comes in */
+gint64
+har_scheduler_wake(HarScheduler * scheduler, gint64 now)
+{
+  guint ix;
+  gint64 wake = G_MAXINT64;
+  HarSchedulerOrigin * item;
+
+  if (scheduler->rate <= 0) return wake;
+  for (ix = 0; ix < scheduler->origins->len; ix++) {
+    item = g_ptr_array_index(scheduler->origins, ix);
+    if (g_queue_is_empty(&item->pending) || item->tokens >= 1) continue;
+    if (scheduler->max_host_connections > 0 && item->active >= scheduler->max_host_connections) continue;
+    wake = MIN(wake, now + (gint64)(1.0e6 * (1 - item->tokens) / scheduler->rate));
+  }
+  return wake;
+}
+
+/* counts the transfers of every origin, including hops, retries and hedges */
+void
+har_scheduler_active(HarScheduler * scheduler, const char * origin, int delta)
+{
+  HarSchedulerOrigin * item;
+
+  if (!scheduler || !scheduler->fair || !origin) return;
+  item = har_scheduler_origin(scheduler, origin);
+  item->active += delta;
+  item->active_max = MAX(item->active_max, item->active);
+}
+
+/* time is the time of the entry, in milliseconds */
+void
+har_scheduler_done(HarScheduler * scheduler, const char * origin, double time)
+{
+  if (!scheduler->fair || !origin) return;
+  g_array_append_val(har_scheduler_origin(scheduler, origin)->network_times, time);
+}
+
+static json_t *
+har_times_to_json(GArray * times, gboolean with_total)
+{
+  GArray * sorted = g_array_sized_new(FALSE, FALSE, sizeof(double), times->len);
+  json_t * stats = json_object();
+  double total = 0;
+  guint ix;
+
+  g_array_append_vals(sorted, times->data, times->len);
+  g_array_sort(sorted, &har_compare_double);
+  for (ix = 0; ix < sorted->len; ix++) {
+    total += g_array_index(sorted, double, ix);
+  }
+  if (sorted->len) {
+    json_object_set_new(stats, "mean", json_real(total / sorted->len));
+    json_object_set_new(stats, "p50", json_real(g_array_index(sorted, double, (guint)(0.50 * (sorted->len - 1) + 0.5))));
+    json_object_set_new(stats, "p95", json_real(g_array_index(sorted, double, (guint)(0.95 * (sorted->len - 1) + 0.5))));
+    json_object_set_new(stats, "max", json_real(g_array_index(sorted, double, sorted->len - 1)));
+  }
+  if (with_total) {
+    json_object_set_new(stats, "total", json_real(total));
+  }
+
+  g_array_free(sorted, TRUE);
+  return stats;
+}
+
+/*
+ * har_scheduler_to_json:
+ *
+ * The time every origin spent waiting for its turn
+ * (queueTime, from the start of the run to the start of
+ * the entry) and on the network (networkTime, the entry time).
+ */
+json_t *
+har_scheduler_to_json(HarScheduler * scheduler)
+{
+  guint ix;
+  json_t * stats = json_object();
+  json_t * origins = json_array();
+  HarSchedulerOrigin * item;
+
+  json_object_set_new(stats, "maxHostConnections", json_integer(scheduler->max_host_connections));
+  json_object_set_new(stats, "rate", json_real(scheduler->rate));
+  json_object_set_new(stats, "burst", json_integer(scheduler->burst));
+  for (ix = 0; ix < scheduler->origins->len; ix++) {
+    item = g_ptr_array_index(scheduler->origins, ix);
+    json_array_append_new(origins,
+                          json_pack("{s:s,s:i,s:i,s:o,s:o}",
+                                    "origin", item->origin,
+                                    "entries", (int)item->queue_times->len,
+                                    "activeMax", item->active_max,
+                                    "queueTime", har_times_to_json(item->queue_times, FALSE),
+                                    "networkTime", har_times_to_json(item->network_times, TRUE)));
+  }
+  json_object_set_new(stats, "origins", origins);
+  return stats;
+}
@@ -0,0 +1,65 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+#ifndef HARCURL_SCHEDULER_H
+#define HARCURL_SCHEDULER_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*
+ * HarScheduler:
+ *
+ * Decides which entry the network stage starts next.
+ * With --max-host-connections or --rate, entries wait in
+ * one queue per origin, and the origins are served
+ * round-robin, skipping those which are at their limit of
+ * transfers or out of tokens, so that one slow origin can
+ * neither hold all the transfers nor be sent too many.
+ * Otherwise, there is a single queue, in input order.
+ */
+typedef struct _HarSchedulerOrigin {
+  gchar * origin;
+  GQueue pending;
+  int entries;
+  int active;
+  int active_max;
+  double tokens;
+  gint64 refilled;
+  GArray * queue_times;
+  GArray * network_times;
+} HarSchedulerOrigin;
+
+typedef struct _HarScheduler {
+  gboolean fair;
+  gboolean pairs;
+  int max_host_connections;
+  double rate;
+  int burst;
+  gint64 started;
+  int remaining;
+  int first;
+  guint cursor;
+  GPtrArray * origins;
+  GHashTable * by_origin;
+
+  /* the origin of the second entry of a pair whose first one was just started */
+  HarSchedulerOrigin * partner;
+} HarScheduler;
+
+void har_scheduler_init(HarScheduler * scheduler, json_t * entries, int first,
+                        int max_host_connections, double rate, int burst, gboolean pairs);
+void har_scheduler_clear(HarScheduler * scheduler);
+int har_scheduler_next(HarScheduler * scheduler, gint64 now, int room, gchar ** origin, double * queue_time);
+gint64 har_scheduler_wake(HarScheduler * scheduler, gint64 now);
+void har_scheduler_active(HarScheduler * scheduler, const char * origin, int delta);
+void har_scheduler_done(HarScheduler * scheduler, const char * origin, double time);
+json_t * har_scheduler_to_json(HarScheduler * scheduler);
+
+#endif /* HARCURL_SCHEDULER_H */
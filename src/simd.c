@@ -0,0 +1,594 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <glib.h>
+
+#include "config.h"
+#include "simd.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAR_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/* what the CPU can do, plus one, once detected */
+static gsize har_simd_detected = 0;
+
+/* the level set by har_simd_set_level(), or -1 */
+static gint har_simd_current = -1;
+
+static HarSimdLevel
+har_simd_cpu_level(void)
+{
+  if (g_once_init_enter(&har_simd_detected)) {
+    int level = HAR_SIMD_NONE;
+#ifdef HAR_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      level = HAR_SIMD_AVX2;
+    } else if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3")) {
+      level = HAR_SIMD_SSE4;
+    }
+#endif
+    g_once_init_leave(&har_simd_detected, (gsize)level + 1);
+  }
+
+  return (HarSimdLevel)(har_simd_detected - 1);
+}
+
+/* called from the worker threads, so both are only read atomically */
+HarSimdLevel
+har_simd_level(void)
+{
+  int level = g_atomic_int_get(&har_simd_current);
+  return level >= 0 ? (HarSimdLevel)level : har_simd_cpu_level();
+}
+
+void
+har_simd_set_level(HarSimdLevel level)
+{
+  /* never go above what the CPU can do */
+  g_atomic_int_set(&har_simd_current, MIN(level, har_simd_cpu_level()));
+}
+
+const char *
+har_simd_level_name(HarSimdLevel level)
+{
+  switch (level) {
+  case HAR_SIMD_SSE4:
+    return "sse4";
+  case HAR_SIMD_AVX2:
+    return "avx2";
+  default:
+    return "none";
+  }
+}
+
+#ifdef HAR_SIMD_X86
+
+/*
+ * UTF-8 validation:
+ *
+ * This is the "lookup" algorithm of Keiser and Lemire,
+ * "Validating UTF-8 In Less Than One Instruction Per Byte".
+ * Every byte is classified by three 16-entry tables (the high
+ * nibble of the previous byte, the low nibble of the previous
+ * byte, and the high nibble of this byte), and any bit that
+ * survives the AND of the three is an error. Multi-byte
+ * sequences that are cut short are found by looking two and
+ * three bytes back. Unlike the paper, NUL is also an error,
+ * just like it is for g_utf8_validate.
+ */
+
+#define HAR_UTF8_TOO_SHORT  (1 << 0)
+#define HAR_UTF8_TOO_LONG   (1 << 1)
+#define HAR_UTF8_OVERLONG_3 (1 << 2)
+#define HAR_UTF8_TOO_LARGE  (1 << 3)
+#define HAR_UTF8_SURROGATE  (1 << 4)
+#define HAR_UTF8_OVERLONG_2 (1 << 5)
+#define HAR_UTF8_TOO_LARGE_1000 (1 << 6)
+#define HAR_UTF8_OVERLONG_4 (1 << 6)
+#define HAR_UTF8_TWO_CONTS  (1 << 7)
+#define HAR_UTF8_CARRY (HAR_UTF8_TOO_SHORT | HAR_UTF8_TOO_LONG | HAR_UTF8_TWO_CONTS)
+
+#define HAR_UTF8_BYTE_1_HIGH                                            \
+  HAR_UTF8_TOO_LONG, HAR_UTF8_TOO_LONG, HAR_UTF8_TOO_LONG, HAR_UTF8_TOO_LONG, \
+  HAR_UTF8_TOO_LONG, HAR_UTF8_TOO_LONG, HAR_UTF8_TOO_LONG, HAR_UTF8_TOO_LONG, \
+  HAR_UTF8_TWO_CONTS, HAR_UTF8_TWO_CONTS, HAR_UTF8_TWO_CONTS, HAR_UTF8_TWO_CONTS, \
+  HAR_UTF8_TOO_SHORT | HAR_UTF8_OVERLONG_2,                             \
+  HAR_UTF8_TOO_SHORT,                                                   \
+  HAR_UTF8_TOO_SHORT | HAR_UTF8_OVERLONG_3 | HAR_UTF8_SURROGATE,        \
+  HAR_UTF8_TOO_SHORT | HAR_UTF8_TOO_LARGE | HAR_UTF8_TOO_LARGE_1000 | HAR_UTF8_OVERLONG_4
+
+#define HAR_UTF8_BYTE_1_LOW                                             \
+  HAR_UTF8_CARRY | HAR_UTF8_OVERLONG_3 | HAR_UTF8_OVERLONG_2 | HAR_UTF8_OVERLONG_4, \
+  HAR_UTF8_CARRY | HAR_UTF8_OVERLONG_2,                                 \
+  HAR_UTF8_CARRY,                                                       \
+  HAR_UTF8_CARRY,                                                       \
+  HAR_UTF8_CARRY | HAR_UTF8_TOO_LARGE,                                  \
+  HAR_UTF8_CARRY | HAR_UTF8_TOO_LARGE | HAR_UTF8_TOO_LARGE_1000,        \
+  HAR_UTF8_CARRY | HAR_UTF8_TOO_LARGE | HAR_UTF8_TOO_LARGE_1000,        \
+  HAR_UTF8_CARRY | HAR_UTF8_TOO_LARGE | HAR_UTF8_TOO_LARGE_1000,        \
+  HAR_UTF8_CARRY | HAR_UTF8_TOO_LARGE | HAR_UTF8_TOO_LARGE_1000,        \
+  HAR_UTF8_CARRY | HAR_UTF8_TOO_LARGE | HAR_UTF8_TOO_LARGE_1000,        \
+  HAR_UTF8_CARRY | HAR_UTF8_TOO_LARGE | HAR_UTF8_TOO_LARGE_1000,        \
+  HAR_UTF8_CARRY | HAR_UTF8_TOO_LARGE | HAR_UTF8_TOO_LARGE_1000,        \
+  HAR_UTF8_CARRY | HAR_UTF8_TOO_LARGE | HAR_UTF8_TOO_LARGE_1000,        \
+  HAR_UTF8_CARRY | HAR_UTF8_TOO_LARGE | HAR_UTF8_TOO_LARGE_1000 | HAR_UTF8_SURROGATE, \
+  HAR_UTF8_CARRY | HAR_UTF8_TOO_LARGE | HAR_UTF8_TOO_LARGE_1000,        \
+  HAR_UTF8_CARRY | HAR_UTF8_TOO_LARGE | HAR_UTF8_TOO_LARGE_1000
+
+#define HAR_UTF8_BYTE_2_HIGH                                            \
+  HAR_UTF8_TOO_SHORT, HAR_UTF8_TOO_SHORT, HAR_UTF8_TOO_SHORT, HAR_UTF8_TOO_SHORT, \
+  HAR_UTF8_TOO_SHORT, HAR_UTF8_TOO_SHORT, HAR_UTF8_TOO_SHORT, HAR_UTF8_TOO_SHORT, \
+  HAR_UTF8_TOO_LONG | HAR_UTF8_OVERLONG_2 | HAR_UTF8_TWO_CONTS | HAR_UTF8_OVERLONG_3 | HAR_UTF8_TOO_LARGE_1000 | HAR_UTF8_OVERLONG_4, \
+  HAR_UTF8_TOO_LONG | HAR_UTF8_OVERLONG_2 | HAR_UTF8_TWO_CONTS | HAR_UTF8_OVERLONG_3 | HAR_UTF8_TOO_LARGE, \
+  HAR_UTF8_TOO_LONG | HAR_UTF8_OVERLONG_2 | HAR_UTF8_TWO_CONTS | HAR_UTF8_SURROGATE | HAR_UTF8_TOO_LARGE, \
+  HAR_UTF8_TOO_LONG | HAR_UTF8_OVERLONG_2 | HAR_UTF8_TWO_CONTS | HAR_UTF8_SURROGATE | HAR_UTF8_TOO_LARGE, \
+  HAR_UTF8_TOO_SHORT, HAR_UTF8_TOO_SHORT, HAR_UTF8_TOO_SHORT, HAR_UTF8_TOO_SHORT
+
+/* the last three bytes of a block may not start a sequence that needs more bytes */
+#define HAR_UTF8_INCOMPLETE                                             \
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,                       \
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1
+
+__attribute__((target("ssse3,sse4.1")))
+static inline __m128i
+har_utf8_check_sse4(__m128i input, __m128i prev_input)
+{
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  const __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+  const __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+  const __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+  __m128i byte_1_high = _mm_shuffle_epi8(_mm_setr_epi8(HAR_UTF8_BYTE_1_HIGH),
+                                         _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+  __m128i byte_1_low = _mm_shuffle_epi8(_mm_setr_epi8(HAR_UTF8_BYTE_1_LOW),
+                                        _mm_and_si128(prev1, nibble));
+  __m128i byte_2_high = _mm_shuffle_epi8(_mm_setr_epi8(HAR_UTF8_BYTE_2_HIGH),
+                                         _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+  __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+  /* 111_____ two bytes back, or 1111____ three bytes back, must be followed by a continuation */
+  __m128i is_third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 0x80)));
+  __m128i is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 0x80)));
+  __m128i must23 = _mm_and_si128(_mm_or_si128(is_third, is_fourth), _mm_set1_epi8((char)0x80));
+
+  return _mm_xor_si128(must23, special);
+}
+
+__attribute__((target("ssse3,sse4.1")))
+static gboolean
+har_utf8_validate_sse4(const gchar * data, gsize len)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i incomplete = _mm_setr_epi8(HAR_UTF8_INCOMPLETE);
+  __m128i error = zero;
+  __m128i prev_input = zero;
+  __m128i prev_incomplete = zero;
+  guint8 tail[16];
+  gsize ix = 0;
+
+  for (;;) {
+    __m128i input;
+    if (ix + 16 <= len) {
+      input = _mm_loadu_si128((const __m128i *)(data + ix));
+    } else if (ix < len) {
+      /* pad with spaces, which are neither NUL nor part of a sequence */
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, data + ix, len - ix);
+      input = _mm_loadu_si128((const __m128i *)tail);
+    } else {
+      break;
+    }
+
+    error = _mm_or_si128(error, _mm_cmpeq_epi8(input, zero));
+    if (_mm_movemask_epi8(input) == 0) {
+      /* all ASCII, so only a sequence left open by the last block can be wrong */
+      error = _mm_or_si128(error, prev_incomplete);
+    } else {
+      error = _mm_or_si128(error, har_utf8_check_sse4(input, prev_input));
+      prev_incomplete = _mm_subs_epu8(input, incomplete);
+    }
+    prev_input = input;
+    ix += 16;
+  }
+
+  error = _mm_or_si128(error, prev_incomplete);
+  return _mm_testz_si128(error, error);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+har_utf8_prev_avx2(__m256i input, __m256i prev_input, int n)
+{
+  /* bring the last 16 bytes of prev_input next to the first 16 of input */
+  __m256i joined = _mm256_permute2x128_si256(prev_input, input, 0x21);
+  switch (n) {
+  case 1:
+    return _mm256_alignr_epi8(input, joined, 15);
+  case 2:
+    return _mm256_alignr_epi8(input, joined, 14);
+  default:
+    return _mm256_alignr_epi8(input, joined, 13);
+  }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+har_utf8_check_avx2(__m256i input, __m256i prev_input)
+{
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i prev1 = har_utf8_prev_avx2(input, prev_input, 1);
+  const __m256i prev2 = har_utf8_prev_avx2(input, prev_input, 2);
+  const __m256i prev3 = har_utf8_prev_avx2(input, prev_input, 3);
+  __m256i byte_1_high = _mm256_shuffle_epi8(_mm256_setr_epi8(HAR_UTF8_BYTE_1_HIGH, HAR_UTF8_BYTE_1_HIGH),
+                                            _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+  __m256i byte_1_low = _mm256_shuffle_epi8(_mm256_setr_epi8(HAR_UTF8_BYTE_1_LOW, HAR_UTF8_BYTE_1_LOW),
+                                           _mm256_and_si256(prev1, nibble));
+  __m256i byte_2_high = _mm256_shuffle_epi8(_mm256_setr_epi8(HAR_UTF8_BYTE_2_HIGH, HAR_UTF8_BYTE_2_HIGH),
+                                            _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+  __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+  __m256i is_third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xe0 - 0x80)));
+  __m256i is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xf0 - 0x80)));
+  __m256i must23 = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth), _mm256_set1_epi8((char)0x80));
+
+  return _mm256_xor_si256(must23, special);
+}
+
+__attribute__((target("avx2")))
+static gboolean
+har_utf8_validate_avx2(const gchar * data, gsize len)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i incomplete = _mm256_setr_epi8(0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                              0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                                              HAR_UTF8_INCOMPLETE);
+  __m256i error = zero;
+  __m256i prev_input = zero;
+  __m256i prev_incomplete = zero;
+  guint8 tail[32];
+  gsize ix = 0;
+
+  for (;;) {
+    __m256i input;
+    if (ix + 32 <= len) {
+      input = _mm256_loadu_si256((const __m256i *)(data + ix));
+    } else if (ix < len) {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, data + ix, len - ix);
+      input = _mm256_loadu_si256((const __m256i *)tail);
+    } else {
+      break;
+    }
+
+    error = _mm256_or_si256(error, _mm256_cmpeq_epi8(input, zero));
+    if (_mm256_movemask_epi8(input) == 0) {
+      error = _mm256_or_si256(error, prev_incomplete);
+    } else {
+      error = _mm256_or_si256(error, har_utf8_check_avx2(input, prev_input));
+      prev_incomplete = _mm256_subs_epu8(input, incomplete);
+    }
+    prev_input = input;
+    ix += 32;
+  }
+
+  error = _mm256_or_si256(error, prev_incomplete);
+  return _mm256_testz_si256(error, error);
+}
+
+/*
+ * Base64 encoding:
+ *
+ * This is Wojciech Muła's method: 12 input bytes are spread
+ * over 16 lanes, the 6-bit indices are cut out with two
+ * multiplies, and the indices are turned into characters by
+ * adding an offset from a 16-entry table.
+ */
+
+__attribute__((target("ssse3,sse4.1")))
+static inline __m128i
+har_base64_encode_block_sse4(__m128i in)
+{
+  const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+  __m128i t0, t1, t2, t3, indices, result, less;
+
+  in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+  t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  indices = _mm_or_si128(t1, t3);
+
+  result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+  return _mm_add_epi8(_mm_shuffle_epi8(shift_lut, result), indices);
+}
+
+__attribute__((target("ssse3,sse4.1")))
+static gsize
+har_base64_encode_sse4(const guchar * data, gsize len, gchar * out)
+{
+  gsize ix = 0;
+  gchar * start = out;
+
+  /* a block reads 16 bytes, but only uses 12 */
+  for (; ix + 16 <= len; ix += 12, out += 16) {
+    __m128i in = _mm_loadu_si128((const __m128i *)(data + ix));
+    _mm_storeu_si128((__m128i *)out, har_base64_encode_block_sse4(in));
+  }
+
+  return (gsize)(out - start) / 4 * 3;
+}
+
+__attribute__((target("avx2")))
+static gsize
+har_base64_encode_avx2(const guchar * data, gsize len, gchar * out)
+{
+  const __m256i shift_lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0);
+  const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                          10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  gsize ix = 0;
+
+  /* a block reads 12+16 bytes, but only uses 24 */
+  for (; ix + 28 <= len; ix += 24, out += 32) {
+    __m256i in = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(data + ix))),
+      _mm_loadu_si128((const __m128i *)(data + ix + 12)), 1);
+    __m256i t0, t1, t2, t3, indices, result, less;
+
+    in = _mm256_shuffle_epi8(in, shuffle);
+    t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    indices = _mm256_or_si256(t1, t3);
+
+    result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    _mm256_storeu_si256((__m256i *)out, _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, result), indices));
+  }
+
+  /* the SSE kernel can still do one more block */
+  return ix + har_base64_encode_sse4(data + ix, len - ix, out);
+}
+
+/*
+ * Base64 decoding:
+ *
+ * Every character is checked and translated with two
+ * nibble tables, and the 6-bit values are packed back into
+ * bytes with two multiply-adds. A block with anything
+ * else in it (padding, line breaks) stops the vector loop,
+ * and the rest is left to glib, so we decode exactly what
+ * g_base64_decode would decode.
+ */
+
+__attribute__((target("ssse3,sse4.1")))
+static inline int
+har_base64_decode_block_sse4(__m128i str, __m128i * out)
+{
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                       0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                         0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  const __m128i slash = _mm_set1_epi8('/');
+  __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), nibble);
+  __m128i lo_nibbles = _mm_and_si128(str, nibble);
+  __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+  __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+  __m128i roll;
+
+  if (!_mm_testz_si128(lo, hi)) {
+    return 0;
+  }
+
+  roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(str, slash), hi_nibbles));
+  str = _mm_add_epi8(str, roll);
+  str = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+  str = _mm_madd_epi16(str, _mm_set1_epi32(0x00011000));
+  *out = _mm_shuffle_epi8(str, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+  return 1;
+}
+
+__attribute__((target("ssse3,sse4.1")))
+static gsize
+har_base64_decode_sse4(const gchar * text, gsize len, guchar * out, gsize * used)
+{
+  gsize ix = 0;
+  guchar * start = out;
+  __m128i block;
+
+  for (; ix + 16 <= len; ix += 16, out += 12) {
+    if (!har_base64_decode_block_sse4(_mm_loadu_si128((const __m128i *)(text + ix)), &block)) {
+      break;
+    }
+    /* this writes 16 bytes, the caller leaves room for it */
+    _mm_storeu_si128((__m128i *)out, block);
+  }
+
+  *used = ix;
+  return (gsize)(out - start);
+}
+
+__attribute__((target("avx2")))
+static gsize
+har_base64_decode_avx2(const gchar * text, gsize len, guchar * out, gsize * used)
+{
+  const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                          0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+  const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0,
+                                            0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i slash = _mm256_set1_epi8('/');
+  gsize ix = 0;
+  gsize rest = 0;
+  guchar * start = out;
+
+  for (; ix + 32 <= len; ix += 32, out += 24) {
+    __m256i str = _mm256_loadu_si256((const __m256i *)(text + ix));
+    __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), nibble);
+    __m256i lo_nibbles = _mm256_and_si256(str, nibble);
+    __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    __m256i roll;
+
+    if (!_mm256_testz_si256(lo, hi)) {
+      break;
+    }
+
+    roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(str, slash), hi_nibbles));
+    str = _mm256_add_epi8(str, roll);
+    str = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+    str = _mm256_madd_epi16(str, _mm256_set1_epi32(0x00011000));
+    str = _mm256_shuffle_epi8(str, pack);
+
+    /* each lane has 12 bytes, followed by 4 bytes of garbage */
+    _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(str));
+    _mm_storeu_si128((__m128i *)(out + 12), _mm256_extracti128_si256(str, 1));
+  }
+
+  out += har_base64_decode_sse4(text + ix, len - ix, out, &rest);
+  *used = ix + rest;
+  return (gsize)(out - start);
+}
+
+#endif /* HAR_SIMD_X86 */
+
+static const char har_base64_alphabet[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+gboolean
+har_utf8_validate(const gchar * data, gsize len)
+{
+#ifdef HAR_SIMD_X86
+  switch (har_simd_level()) {
+  case HAR_SIMD_AVX2:
+    return har_utf8_validate_avx2(data, len);
+  case HAR_SIMD_SSE4:
+    return har_utf8_validate_sse4(data, len);
+  default:
+    break;
+  }
+#endif
+
+  return g_utf8_validate(data, len, NULL);
+}
+
+gchar *
+har_base64_encode(const guchar * data, gsize len)
+{
+  gsize done = 0;
+  gsize ix;
+  gchar * result;
+  gchar * out;
+
+  switch (har_simd_level()) {
+#ifdef HAR_SIMD_X86
+  case HAR_SIMD_AVX2:
+    result = g_malloc((len / 3 + 1) * 4 + 1);
+    done = har_base64_encode_avx2(data, len, result);
+    break;
+  case HAR_SIMD_SSE4:
+    result = g_malloc((len / 3 + 1) * 4 + 1);
+    done = har_base64_encode_sse4(data, len, result);
+    break;
+#endif
+  default:
+    return g_base64_encode(data, len);
+  }
+
+  /* the last few bytes, with padding */
+  out = result + done / 3 * 4;
+  for (ix = done; ix + 3 <= len; ix += 3) {
+    guint32 v = (data[ix] << 16) | (data[ix + 1] << 8) | data[ix + 2];
+    *out++ = har_base64_alphabet[(v >> 18) & 0x3f];
+    *out++ = har_base64_alphabet[(v >> 12) & 0x3f];
+    *out++ = har_base64_alphabet[(v >> 6) & 0x3f];
+    *out++ = har_base64_alphabet[v & 0x3f];
+  }
+  if (len - ix == 1) {
+    guint32 v = data[ix] << 16;
+    *out++ = har_base64_alphabet[(v >> 18) & 0x3f];
+    *out++ = har_base64_alphabet[(v >> 12) & 0x3f];
+    *out++ = '=';
+    *out++ = '=';
+  } else if (len - ix == 2) {
+    guint32 v = (data[ix] << 16) | (data[ix + 1] << 8);
+    *out++ = har_base64_alphabet[(v >> 18) & 0x3f];
+    *out++ = har_base64_alphabet[(v >> 12) & 0x3f];
+    *out++ = har_base64_alphabet[(v >> 6) & 0x3f];
+    *out++ = '=';
+  }
+  *out = '\0';
+
+  return result;
+}
+
+guchar *
+har_base64_decode(const gchar * text, gsize * out_len)
+{
+  gsize len = strlen(text);
+  gsize used = 0;
+  gsize done = 0;
+  gsize rest_len = 0;
+  guchar * result;
+  guchar * rest;
+
+  switch (har_simd_level()) {
+#ifdef HAR_SIMD_X86
+  case HAR_SIMD_AVX2:
+    result = g_malloc(len / 4 * 3 + 32);
+    done = har_base64_decode_avx2(text, len, result, &used);
+    break;
+  case HAR_SIMD_SSE4:
+    result = g_malloc(len / 4 * 3 + 32);
+    done = har_base64_decode_sse4(text, len, result, &used);
+    break;
+#endif
+  default:
+    return g_base64_decode(text, out_len);
+  }
+
+  /* the vector loop only stops on a 4 character boundary, so glib can pick up from there */
+  if (used < len) {
+    rest = g_base64_decode(text + used, &rest_len);
+    memcpy(result + done, rest, rest_len);
+    g_free(rest);
+  }
+
+  *out_len = done + rest_len;
+  return result;
+}
@@ -0,0 +1,41 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+#ifndef HARCURL_SIMD_H
+#define HARCURL_SIMD_H
+
+#include <glib.h>
+
+/*
+ * HarSimdLevel:
+ *
+ * The vector instructions that the kernels below may use.
+ * The level is detected once at runtime, and HAR_SIMD_NONE
+ * falls back to the glib functions, which give the same results.
+ */
+typedef enum _HarSimdLevel {
+  HAR_SIMD_NONE = 0,
+  HAR_SIMD_SSE4,
+  HAR_SIMD_AVX2,
+} HarSimdLevel;
+
+HarSimdLevel har_simd_level(void);
+void har_simd_set_level(HarSimdLevel level);
+const char * har_simd_level_name(HarSimdLevel level);
+
+/* same as g_utf8_validate(data, len, NULL), including that NUL is invalid */
+gboolean har_utf8_validate(const gchar * data, gsize len);
+
+/* same as g_base64_encode, the result must be freed with g_free */
+gchar * har_base64_encode(const guchar * data, gsize len);
+
+/* same as g_base64_decode, the result must be freed with g_free */
+guchar * har_base64_decode(const gchar * text, gsize * out_len);
+
+#endif /* HARCURL_SIMD_H */
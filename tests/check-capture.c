@@ -0,0 +1,157 @@
+/* -*- mode: c; c-basic-offset: 2; tab-width: 80; -*- */
+/* harcurl - HTTP Archive (HAR) support for libcurl
+ * Copyright (C) 2014-2015  Andrew Robbins
+ *
+ * This library ("it") is free software; it is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; you can redistribute it and/or modify it under the terms of the
+ * GNU Lesser General Public License ("LGPLv3") <https://www.gnu.org/licenses/lgpl.html>.
+ */
+
+/*
+ * check-capture:
+ *
+ * Run by "make check". The same log, written as HAR, and
+ * captured (with --profile, and gzip blocks small enough for
+ * there to be several) then converted, must have the same
+ * entries, and the converted ones must have their
+ * _harcurlTimings. The entries are file:// URLs of the
+ * source tree and of the harcurl program (a binary body),
+ * so that no server is needed.
+ *
+ * $HARCURL is the program to check, and $HARCURL_SRCDIR the
+ * top of the source tree, both set by tests/Makefile.am.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <jansson.h>
+
+#define CHECK_ENTRIES 20
+
+/* automake takes 77 for a skipped test */
+#define CHECK_SKIP 77
+
+static const char * check_files[] = {
+  "README.md",
+  "tests/request-basic.json",
+  "tests/request-formdata.json",
+  "tests/log-basic.json",
+  "src/main.c",
+  "src/capture.c",
+  "src/headers.c",
+};
+
+static json_t *
+check_run_json(const char * command)
+{
+  FILE * pipe = popen(command, "r");
+  json_t * output;
+  json_error_t error;
+
+  if (!pipe) return NULL;
+  output = json_loadf(pipe, 0, &error);
+  pclose(pipe);
+  return output;
+}
+
+/* an absolute file:// URL, or NULL */
+static gchar *
+check_file_url(const char * dir, const char * file)
+{
+  gchar * path = dir ? g_strconcat(dir, "/", file, NULL) : g_strdup(file);
+  char resolved[PATH_MAX];
+  gchar * url = NULL;
+
+  if (realpath(path, resolved)) {
+    url = g_strconcat("file://", resolved, NULL);
+  }
+  g_free(path);
+  return url;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ix;
+  int fd;
+  int mismatches = 0;
+  const char * harcurl = g_getenv("HARCURL");
+  const char * srcdir = g_getenv("HARCURL_SRCDIR");
+  gchar * path = NULL;
+  gchar * capture;
+  gchar * command;
+  gchar * url;
+  json_t * log = json_object();
+  json_t * entries = json_array();
+  json_t * direct;
+  json_t * converted;
+  json_t * direct_entries;
+  json_t * converted_entries;
+
+  if (!harcurl || access(harcurl, X_OK) != 0) {
+    fprintf(stderr, "set HARCURL to the harcurl program to check\n");
+    return CHECK_SKIP;
+  }
+
+  for (ix = 0; ix < CHECK_ENTRIES; ix++) {
+    if (ix % (G_N_ELEMENTS(check_files) + 1) == G_N_ELEMENTS(check_files)) {
+      url = check_file_url(NULL, harcurl);
+    } else {
+      url = check_file_url(srcdir ? srcdir : ".", check_files[ix % (G_N_ELEMENTS(check_files) + 1)]);
+    }
+    if (!url) {
+      fprintf(stderr, "unable to find the files of entry %d\n", ix);
+      return CHECK_SKIP;
+    }
+    json_array_append_new(entries, json_pack("{s:{s:s,s:s}}", "request", "method", "GET", "url", url));
+    g_free(url);
+  }
+  json_object_set_new(log, "log", json_pack("{s:s,s:o}", "version", "1.2", "entries", entries));
+
+  fd = g_file_open_tmp("harcurl-check-XXXXXX.json", &path, NULL);
+  if (fd < 0) {
+    fprintf(stderr, "unable to create a temporary file\n");
+    return EXIT_FAILURE;
+  }
+  close(fd);
+  json_dump_file(log, path, JSON_COMPACT);
+  json_decref(log);
+  capture = g_strconcat(path, ".hcap", NULL);
+
+  command = g_strdup_printf("'%s' -v --profile -p 4 < '%s' 2>/dev/null", harcurl, path);
+  direct = check_run_json(command);
+  g_free(command);
+  command = g_strdup_printf("'%s' -v --profile -p 4 --capture '%s' --capture-compression gzip"
+                            " --capture-block-size 4 < '%s' 2>/dev/null && '%s' convert '%s'",
+                            harcurl, capture, path, harcurl, capture);
+  converted = check_run_json(command);
+  g_free(command);
+  unlink(capture);
+  unlink(path);
+
+  direct_entries = json_object_get(json_object_get(direct, "log"), "entries");
+  converted_entries = json_object_get(json_object_get(converted, "log"), "entries");
+  for (ix = 0; ix < CHECK_ENTRIES; ix++) {
+    json_t * a = json_array_get(direct_entries, ix);
+    json_t * b = json_array_get(converted_entries, ix);
+    if (!a || !b ||
+        !json_equal(json_object_get(a, "request"), json_object_get(b, "request")) ||
+        !json_equal(json_object_get(json_object_get(a, "response"), "content"),
+                    json_object_get(json_object_get(b, "response"), "content")) ||
+        !json_is_object(json_object_get(b, "_harcurlTimings"))) {
+      fprintf(stderr, "entry %d differs after --capture and convert\n", ix);
+      mismatches++;
+    }
+  }
+  printf("capture: %d of %d entries round-trip\n", CHECK_ENTRIES - mismatches, CHECK_ENTRIES);
+
+  json_decref(direct);
+  json_decref(converted);
+  g_free(capture);
+  g_free(path);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}